@@ -41,6 +41,18 @@ public:
     return x;
   }
 
+  // 包围盒中心，BVH 构建时按中心位置划分物体
+  point3 centroid() const {
+    return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+  }
+
+  // 表面积，SAH 用它估计光线击中包围盒的概率
+  double surface_area() const {
+    auto dx = x.size(), dy = y.size(), dz = z.size();
+    if (dx < 0 || dy < 0 || dz < 0) return 0; // empty box
+    return 2 * (dx * dy + dy * dz + dz * dx);
+  }
+
   //// 计算是否相撞
   //bool hit(const ray& r, interval ray_t) const {
   //  for (int a = 0; a < 3; a++) {
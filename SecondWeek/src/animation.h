@@ -0,0 +1,199 @@
+﻿#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "bvh_wide.h"
+#include "camera.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// 相机路径：按时间排列的关键帧，lookfrom、lookat、vfov 用 Catmull-Rom 样条插值，
+// 曲线经过每个关键帧，经过时速度连续。关键帧的时间间隔可以不均匀
+class camera_path {
+public:
+  void add(double time, const point3& lookfrom, const point3& lookat, double vfov) {
+    keyframe key{ time, lookfrom, lookat, vfov };
+    auto it = keys.begin();
+    while (it != keys.end() && it->time <= time) ++it;
+    keys.insert(it, key);
+  }
+
+  bool empty() const { return keys.empty(); }
+
+  // 把 time 处的相机写入 cam，time 在第一个关键帧之前或最后一个之后时停在两端
+  void apply(double time, camera& cam) const {
+    if (keys.empty())
+      return;
+    if (keys.size() == 1 || time <= keys.front().time) {
+      set(keys.front(), cam);
+      return;
+    }
+    if (time >= keys.back().time) {
+      set(keys.back(), cam);
+      return;
+    }
+
+    size_t i = 0;
+    while (keys[i + 1].time < time) ++i;
+    auto u = (time - keys[i].time) / (keys[i + 1].time - keys[i].time);
+
+    cam.lookfrom = spline(i, u, [](const keyframe& k) { return k.lookfrom; });
+    cam.lookat = spline(i, u, [](const keyframe& k) { return k.lookat; });
+    cam.vfov = spline(i, u, [](const keyframe& k) { return k.vfov; });
+  }
+
+private:
+  struct keyframe {
+    double time;
+    point3 lookfrom;
+    point3 lookat;
+    double vfov;
+  };
+
+  std::vector<keyframe> keys;
+
+  static void set(const keyframe& k, camera& cam) {
+    cam.lookfrom = k.lookfrom;
+    cam.lookat = k.lookat;
+    cam.vfov = k.vfov;
+  }
+
+  // 第 i 段上的 Hermite 插值。切线取相邻两个关键帧的差商，换算到本段的参数 u ∈ [0,1]；两端用单侧差商
+  template <typename Get>
+  auto spline(size_t i, double u, Get get) const -> decltype(get(keys[0])) {
+    const auto& k0 = keys[i];
+    const auto& k1 = keys[i + 1];
+    auto p0 = get(k0);
+    auto p1 = get(k1);
+    auto span = k1.time - k0.time;
+
+    auto m0 = p1 - p0;
+    if (i > 0)
+      m0 = (p1 - get(keys[i - 1])) * (span / (k1.time - keys[i - 1].time));
+    auto m1 = p1 - p0;
+    if (i + 2 < keys.size())
+      m1 = (get(keys[i + 2]) - p0) * (span / (keys[i + 2].time - k0.time));
+
+    auto u2 = u * u, u3 = u2 * u;
+    return p0 * (2 * u3 - 3 * u2 + 1) + m0 * (u3 - 2 * u2 + u) + p1 * (-2 * u3 + 3 * u2) + m1 * (u3 - u2);
+  }
+};
+
+// 动画场景：物体和 BVH 在帧之间一直留在内存里。物体移动后 update 先 refit，
+// 只有树的 SAH 代价超过刚构建时的 rebuild_threshold 倍才整棵重建
+class animated_scene {
+public:
+  // 一次更新的结果：是否重建、耗时、refit 后(重建前)的代价相对刚构建时的倍数
+  struct update_result {
+    bool rebuilt = false;
+    double ms = 0;
+    double cost_ratio = 1;
+  };
+
+  animated_scene(const hittable_list& objects, double rebuild_threshold = 1.5, const bvh_options& opts = bvh_options())
+    : objects(objects), rebuild_threshold(rebuild_threshold), opts(opts) {
+    auto start = std::chrono::steady_clock::now();
+    rebuild();
+    build_ms = elapsed_ms(start);
+  }
+
+  const hittable& world() const { return *accel; }
+
+  // 第一次构建的耗时
+  double initial_build_ms() const { return build_ms; }
+
+  update_result update() {
+    auto start = std::chrono::steady_clock::now();
+    update_result result;
+
+    accel->refit();
+    result.cost_ratio = built_cost > 0 ? accel->sah_cost(opts.traversal_cost) / built_cost : 1;
+    if (result.cost_ratio > rebuild_threshold) {
+      rebuild();
+      result.rebuilt = true;
+    }
+
+    result.ms = elapsed_ms(start);
+    return result;
+  }
+
+  void rebuild() {
+    accel = make_shared<bvh8>(objects, opts);
+    built_cost = accel->sah_cost(opts.traversal_cost);
+  }
+
+private:
+  hittable_list objects;
+  double rebuild_threshold;
+  bvh_options opts;
+  shared_ptr<bvh8> accel;
+  double built_cost = 0;
+  double build_ms = 0;
+};
+
+struct sequence_settings {
+  int frame_count = 24;
+  int first_frame = 0;                            // 从这一帧开始渲染，用于接着渲染中断的序列(animate 只依赖时间，不用补前面的帧)
+  std::string output_pattern = "frame_%04d.ppm";  // printf 格式，%d 替换为帧号，扩展名决定图像格式
+};
+
+inline std::string frame_file_name(const std::string& pattern, int frame) {
+  std::vector<char> buffer(pattern.size() + 32);
+  std::snprintf(buffer.data(), buffer.size(), pattern.c_str(), frame);
+  return buffer.data();
+}
+
+// 渲染帧序列：第 f 帧的动画时间为 f / (frame_count - 1)，从 0 走到 1。
+// 相机按 path 摆放(path 为空时不动)；animate(time) 移动物体，为空表示只有相机在动，场景不用更新。
+// 每帧输出 BVH 更新和渲染的耗时，最后输出合计
+inline void render_sequence(camera& cam, animated_scene& scene, const camera_path& path,
+                            const sequence_settings& settings,
+                            const std::function<void(double)>& animate = nullptr) {
+  double update_total_ms = 0, render_total_s = 0;
+  int rebuilds = 0, rendered = 0;
+  std::clog << "Sequence: " << settings.frame_count << " frames, initial BVH build "
+    << scene.initial_build_ms() << " ms\n";
+
+  for (int frame = std::max(0, settings.first_frame); frame < settings.frame_count; ++frame) {
+    auto time = settings.frame_count > 1 ? static_cast<double>(frame) / (settings.frame_count - 1) : 0.0;
+
+    animated_scene::update_result update;
+    if (animate) {
+      animate(time);
+      update = scene.update();
+    }
+
+    path.apply(time, cam);
+    cam.output_file = frame_file_name(settings.output_pattern, frame);
+
+    auto start = std::chrono::steady_clock::now();
+    cam.render(scene.world());
+    auto render_s = elapsed_ms(start) / 1000;
+
+    update_total_ms += update.ms;
+    render_total_s += render_s;
+    rebuilds += update.rebuilt;
+    ++rendered;
+
+    std::clog << "Frame " << frame << ": ";
+    if (!animate)
+      std::clog << "static scene";
+    else
+      std::clog << (update.rebuilt ? "rebuild " : "refit ") << update.ms << " ms (SAH x" << update.cost_ratio << ")";
+    std::clog << ", render " << render_s << " s -> " << cam.output_file << '\n';
+  }
+
+  std::clog << "Sequence done: " << rendered << " frames, BVH updates " << update_total_ms << " ms ("
+    << rebuilds << " rebuilds), rendering " << render_total_s << " s\n";
+}
+
+#endif
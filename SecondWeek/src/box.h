@@ -0,0 +1,165 @@
+﻿#ifndef BOX_H
+#define BOX_H
+
+#include "common.h"
+
+#include "hittable.h"
+#include "material.h"
+
+// 轴对齐长方体：一次 slab 测试求出光线进入、离开的距离和对应的轴，
+// 法线和 uv 由击中的面推出(uv 和 box_quads 的六个 quad 相同，贴图结果不变)。
+// 每个盒子只占一个对象：两个角点和材质
+class box_prim : public hittable {
+public:
+  box_prim(const point3& a, const point3& b, shared_ptr<material> mat)
+    : bounds(a, b), mat(mat) {}
+
+  // 整条直线穿过盒子的区间 [t_enter, t_exit](不受 ray_t 限制，起点在盒子里时 t_enter < 0)，
+  // enter_axis/exit_axis 为进入、离开时穿过的面所在的轴。没有穿过时返回 false
+  bool intersect(const ray& r, double& t_enter, double& t_exit, int& enter_axis, int& exit_axis) const {
+    t_enter = -infinity;
+    t_exit = infinity;
+    enter_axis = exit_axis = 0;
+    for (int a = 0; a < 3; a++) {
+      auto invD = 1 / r.direction()[a];
+      auto orig = r.origin()[a];
+
+      auto t0 = (bounds.axis(a).min - orig) * invD;
+      auto t1 = (bounds.axis(a).max - orig) * invD;
+      if (invD < 0)
+        std::swap(t0, t1);
+
+      // 方向分量为 0 且起点在面上时 t 为 NaN，比较为假，这条轴不限制区间
+      if (t0 > t_enter) { t_enter = t0; enter_axis = a; }
+      if (t1 < t_exit) { t_exit = t1; exit_axis = a; }
+    }
+    return t_enter <= t_exit;
+  }
+
+  bool intersect(const ray& r, double& t_enter, double& t_exit) const {
+    int enter_axis, exit_axis;
+    return intersect(r, t_enter, t_exit, enter_axis, exit_axis);
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    double t_enter, t_exit;
+    int enter_axis, exit_axis;
+    if (!intersect(r, t_enter, t_exit, enter_axis, exit_axis))
+      return false;
+
+    // 起点在盒子外时击中进入面，在盒子里时击中离开面
+    int axis;
+    bool max_side;
+    if (ray_t.contains(t_enter)) {
+      rec.t = t_enter;
+      axis = enter_axis;
+      max_side = r.direction()[axis] < 0;
+    }
+    else if (ray_t.contains(t_exit)) {
+      rec.t = t_exit;
+      axis = exit_axis;
+      max_side = r.direction()[axis] >= 0;
+    }
+    else
+      return false;
+
+    rec.p = r.at(rec.t);
+    rec.mat_ptr = mat.get();
+    vec3 outward(0, 0, 0);
+    outward[axis] = max_side ? 1 : -1;
+    rec.set_face_normal(r, outward);
+    face_uv(axis, max_side, rec.p, rec);
+    return true;
+  }
+
+  void hit_intervals(const ray& r, span_list& spans) const override {
+    double t_enter, t_exit;
+    if (intersect(r, t_enter, t_exit))
+      spans.add(interval(t_enter, t_exit));
+  }
+
+  aabb bounding_box() const override {
+    auto bbox = bounds;
+    return bbox.pad();
+  }
+
+  // 发光的盒子作为一个光源：按面积在整个表面上均匀取点。
+  // 凸体被一个方向穿过两次(进入面和离开面)，两处的密度都要算上
+  double pdf_value(const point3& origin, const vec3& direction) const override {
+    double t_enter, t_exit;
+    int enter_axis, exit_axis;
+    if (!intersect(ray(origin, direction, 0.0), t_enter, t_exit, enter_axis, exit_axis) || t_exit < 0.001)
+      return 0;
+
+    auto area = bounds.surface_area();
+    auto length_squared = direction.length_squared();
+    auto length = sqrt(length_squared);
+    auto density = [&](double t, int axis) {
+      auto cosine = fabs(direction[axis]) / length;
+      return t * t * length_squared / (cosine * area);
+    };
+
+    auto pdf = density(t_exit, exit_axis);
+    if (t_enter >= 0.001)
+      pdf += density(t_enter, enter_axis);
+    return pdf;
+  }
+
+  vec3 random(const point3& origin) const override {
+    double size[3] = { bounds.x.size(), bounds.y.size(), bounds.z.size() };
+    double face_area[3] = { size[1] * size[2], size[2] * size[0], size[0] * size[1] };
+
+    // 先按面积选一对面，再选其中一面
+    auto pick = random_double() * (face_area[0] + face_area[1] + face_area[2]);
+    int axis = pick < face_area[0] ? 0 : pick < face_area[0] + face_area[1] ? 1 : 2;
+
+    point3 p;
+    for (int a = 0; a < 3; a++)
+      p[a] = bounds.axis(a).min + random_double() * size[a];
+    p[axis] = random_double() < 0.5 ? bounds.axis(axis).min : bounds.axis(axis).max;
+    return p - origin;
+  }
+
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    if (mat->is_emissive())
+      lights.push_back(this);
+  }
+
+private:
+  aabb bounds;
+  shared_ptr<material> mat;
+
+  // 厚度为零的盒子(比如一块薄板)在该轴上没有范围，坐标取 0，避免 0/0 得到 NaN
+  static double face_fraction(double x, const interval& extent) {
+    auto size = extent.size();
+    return size > 0 ? (x - extent.min) / size : 0;
+  }
+
+  // 每个面的 uv 沿用 box_quads 中对应 quad 的 (Q, u, v)：
+  // 前后两面 u 沿 x、左右两面 u 沿 z，都是从外面看时向右；上下两面 v 沿 z
+  void face_uv(int axis, bool max_side, const point3& p, hit_record& rec) const {
+    auto fx = face_fraction(p.x(), bounds.x);
+    auto fy = face_fraction(p.y(), bounds.y);
+    auto fz = face_fraction(p.z(), bounds.z);
+
+    if (axis == 0) {
+      rec.u = max_side ? 1 - fz : fz; // right / left
+      rec.v = fy;
+    }
+    else if (axis == 1) {
+      rec.u = fx;
+      rec.v = max_side ? 1 - fz : fz; // top / bottom
+    }
+    else {
+      rec.u = max_side ? fx : 1 - fx; // front / back
+      rec.v = fy;
+    }
+  }
+};
+
+inline shared_ptr<box_prim> box(const point3& a, const point3& b, shared_ptr<material> mat) {
+  // a、b为长方体对角线两点
+  return make_shared<box_prim>(a, b, mat);
+}
+
+#endif
@@ -5,16 +5,320 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+// BVH 剖分方式
+enum class bvh_split {
+  random_median, // 按节点区间选一个轴，按包围盒最小值排序后从中间切开(旧版)
+  sah            // 分桶的表面积启发式(Surface Area Heuristic)
+};
+
+struct bvh_options {
+  bvh_split split = bvh_split::sah;
+  int max_leaf_size = 4;         // 叶子最多容纳的物体数
+  int sah_buckets = 12;          // SAH 沿每个轴的分桶数
+  double traversal_cost = 0.125; // 遍历一个节点相对于求交一个物体的代价
+  size_t parallel_threshold = 4096; // 物体数超过该值的子树作为独立任务并行构建
+  bool pack_spheres = true;      // linear_bvh：全是球的叶子合并为一个 sphere_set
+  int max_time_splits = 4;       // motion_bvh：从根到叶子最多把时间区间对半分几次
+  bool interpolate_motion = true; // compile_scene：有移动的图元时建 motion_bvh，为 false 时仍建 bvh8
+  bool report = true;            // 构建完成后输出耗时和内存
+
+  // 叶子容量至少为 1，max_leaf_size <= 0 时不会转成 size_t 后变成极大值
+  size_t leaf_capacity() const { return static_cast<size_t>(std::max(1, max_leaf_size)); }
+};
+
+// 构建统计：耗时、节点数、BVH 占用的内存和构建期间的峰值内存
+struct bvh_build_stats {
+  double build_ms = 0;
+  size_t primitive_count = 0;
+  size_t node_count = 0;
+  size_t memory_bytes = 0;
+  size_t peak_build_bytes = 0;
+
+  void print(const char* name) const {
+    std::clog << name << ": " << primitive_count << " objects, " << node_count << " nodes, "
+      << build_ms << " ms, " << memory_bytes / 1024.0 / 1024.0 << " MB (peak "
+      << peak_build_bytes / 1024.0 / 1024.0 << " MB while building)\n";
+  }
+};
+
+inline double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// SAH 选出的剖分：沿 axis 轴，把中心落在 [0, bucket] 号桶里的物体分到左边
+struct sah_split {
+  int axis = -1;
+  int bucket = 0;
+  int bucket_count = 1;
+  double cmin = 0;   // 中心包围盒在该轴上的起点
+  double cscale = 0; // 从坐标到桶编号的缩放
+  double cost = infinity;
+
+  int bucket_of(const point3& centroid) const {
+    int b = static_cast<int>(cscale * (centroid[axis] - cmin));
+    return b < 0 ? 0 : (b >= bucket_count ? bucket_count - 1 : b);
+  }
+
+  bool goes_left(const point3& centroid) const { return bucket_of(centroid) <= bucket; }
+};
+
+// 构建时用的轻量包围盒：只做 min/max 累积，比用 interval/fmin 拼 aabb 快得多。
+// 默认构造不初始化(分桶数组按需清空)，空包围盒用 empty() 取得。
+struct build_bounds {
+  double lo[3];
+  double hi[3];
+
+  static build_bounds empty() {
+    return build_bounds{ { infinity, infinity, infinity }, { -infinity, -infinity, -infinity } };
+  }
+
+  void grow(const aabb& box) {
+    for (int a = 0; a < 3; ++a) {
+      const auto& ax = box.axis(a);
+      lo[a] = ax.min < lo[a] ? ax.min : lo[a];
+      hi[a] = ax.max > hi[a] ? ax.max : hi[a];
+    }
+  }
+
+  void grow(const point3& p) {
+    for (int a = 0; a < 3; ++a) {
+      lo[a] = p[a] < lo[a] ? p[a] : lo[a];
+      hi[a] = p[a] > hi[a] ? p[a] : hi[a];
+    }
+  }
+
+  void grow(const build_bounds& b) {
+    for (int a = 0; a < 3; ++a) {
+      lo[a] = b.lo[a] < lo[a] ? b.lo[a] : lo[a];
+      hi[a] = b.hi[a] > hi[a] ? b.hi[a] : hi[a];
+    }
+  }
+
+  double surface_area() const {
+    auto dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+    if (dx < 0 || dy < 0 || dz < 0) return 0;
+    return 2 * (dx * dy + dy * dz + dz * dx);
+  }
+};
+
+// 对 count 个物体做分桶 SAH，box_of(i)/centroid_of(i) 返回第 i 个物体的包围盒和中心。
+// 三个轴的分桶在同一遍循环里完成。返回的 cost 与"全部放进一个叶子"的代价(= count)直接可比。
+template <typename BoxOf, typename CentroidOf>
+sah_split find_sah_split(size_t count, BoxOf box_of, CentroidOf centroid_of, const aabb& bounds,
+                         const bvh_options& opts) {
+  sah_split best;
+
+  auto centroid_bounds = build_bounds::empty();
+  for (size_t i = 0; i < count; ++i)
+    centroid_bounds.grow(centroid_of(i));
+
+  // 分桶数组放在栈上，构建过程中不做堆分配
+  const int max_buckets = 32;
+  // 物体很少时桶数不超过物体数，小节点不必初始化整套桶
+  best.bucket_count = std::max(2, std::min({ opts.sah_buckets, max_buckets, static_cast<int>(std::min<size_t>(count, max_buckets)) }));
+  const int buckets = best.bucket_count;
+
+  sah_split candidate[3];
+  bool splittable[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    auto extent = centroid_bounds.hi[axis] - centroid_bounds.lo[axis];
+    splittable[axis] = extent > 0; // 所有中心重合时这个轴分不开
+    candidate[axis] = best;
+    candidate[axis].axis = axis;
+    candidate[axis].cmin = centroid_bounds.lo[axis];
+    candidate[axis].cscale = splittable[axis] ? buckets / extent : 0;
+  }
+
+  build_bounds bucket_box[3][max_buckets];
+  int bucket_count[3][max_buckets];
+  for (int axis = 0; axis < 3; ++axis) {
+    for (int b = 0; b < buckets; ++b) {
+      bucket_box[axis][b] = build_bounds::empty();
+      bucket_count[axis][b] = 0;
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    auto box = box_of(i);
+    auto c = centroid_of(i);
+    for (int axis = 0; axis < 3; ++axis) {
+      int b = candidate[axis].bucket_of(c);
+      bucket_box[axis][b].grow(box);
+      bucket_count[axis][b]++;
+    }
+  }
+
+  auto area = bounds.surface_area();
+  double right_area[max_buckets];
+  int right_count[max_buckets];
+
+  for (int axis = 0; axis < 3; ++axis) {
+    if (!splittable[axis]) continue;
+
+    // 从右往左累计，得到每个切分位置右侧的面积和数量
+    auto acc = build_bounds::empty();
+    int n = 0;
+    for (int b = buckets - 1; b > 0; --b) {
+      acc.grow(bucket_box[axis][b]);
+      n += bucket_count[axis][b];
+      right_area[b] = acc.surface_area();
+      right_count[b] = n;
+    }
+
+    acc = build_bounds::empty();
+    n = 0;
+    for (int b = 0; b < buckets - 1; ++b) {
+      acc.grow(bucket_box[axis][b]);
+      n += bucket_count[axis][b];
+      if (n == 0 || right_count[b + 1] == 0) continue;
+
+      auto cost = opts.traversal_cost
+        + (acc.surface_area() * n + right_area[b + 1] * right_count[b + 1]) / area;
+      if (cost < best.cost) {
+        best = candidate[axis];
+        best.bucket = b;
+        best.cost = cost;
+      }
+    }
+  }
+
+  return best;
+}
 
 class bvh_node : public hittable {
 public:
-  bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
+  bvh_node(const hittable_list& list, const bvh_options& opts = bvh_options())
+    : bvh_node(list.objects, 0, list.objects.size(), opts) {}
+
+  bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end,
+           const bvh_options& opts = bvh_options()) {
+    auto build_start = std::chrono::steady_clock::now();
+
+    // 只在这里复制一次，之后每层递归都在同一个数组上原地排序/划分
+    std::vector<shared_ptr<hittable>> objects(src_objects.begin() + start, src_objects.begin() + end);
+    build_counters counts;
+    build(objects, 0, objects.size(), opts, counts);
+
+    if (opts.report) {
+      bvh_build_stats stats;
+      stats.build_ms = elapsed_ms(build_start);
+      stats.primitive_count = objects.size();
+      stats.node_count = counts.nodes;
+      // bvh_node 仍然每个节点单独 new 一次(数组存放的版本是 linear_bvh)。除根节点外每个节点
+      // 还有一个独立的 shared_ptr 控制块(虚表指针、两个引用计数、对象指针)，叶子的物体数组也单独分配；
+      // 不含分配器自身的开销
+      auto control_block = 2 * sizeof(void*) + 2 * sizeof(long);
+      stats.memory_bytes = counts.nodes * sizeof(bvh_node) + (counts.nodes - 1) * control_block
+        + counts.leaf_slots * sizeof(shared_ptr<hittable>);
+      stats.peak_build_bytes = stats.memory_bytes + objects.size() * sizeof(shared_ptr<hittable>);
+      stats.print("bvh_node");
+    }
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    if (!bbox.hit(r, ray_t))
+      return false;
+
+    if (!leaf_objects.empty()) {
+      // 叶子节点：依次测试叶子中的物体，保留最近的交点
+      bool hit_anything = false;
+      for (const auto& object : leaf_objects) {
+        if (object->hit(r, ray_t, rec)) {
+          hit_anything = true;
+          ray_t.max = rec.t;
+        }
+      }
+      return hit_anything;
+    }
+
+    bool hit_left = left->hit(r, ray_t, rec);
+    bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+    return hit_left || hit_right;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    if (!leaf_objects.empty()) {
+      for (const auto& object : leaf_objects)
+        object->gather_lights(lights);
+      return;
+    }
+    left->gather_lights(lights);
+    if (right != left)
+      right->gather_lights(lights);
+  }
+
+  bool stochastic_hit() const override {
+    if (!leaf_objects.empty()) {
+      for (const auto& object : leaf_objects)
+        if (object->stochastic_hit())
+          return true;
+      return false;
+    }
+    return left->stochastic_hit() || right->stochastic_hit();
+  }
+
+private:
+  shared_ptr<hittable> left;
+  shared_ptr<hittable> right;
+  std::vector<shared_ptr<hittable>> leaf_objects; // 非空时本节点为叶子
+  aabb bbox;
+
+  // 构建统计，并行构建的子树一起累加
+  struct build_counters {
+    std::atomic<size_t> nodes{ 1 };
+    std::atomic<size_t> leaf_slots{ 0 }; // 叶子物体数组的容量之和
+  };
+
+  bvh_node() {}
 
-  bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
-    auto objects = src_objects; // Create a modifiable array of the source scene objects
+  void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+             const bvh_options& opts, build_counters& counts) {
+    if (opts.split == bvh_split::sah)
+      build_sah(objects, start, end, opts, counts);
+    else
+      build_random_median(objects, start, end, opts, counts);
 
-    int axis = random_int(0, 2); // 随机选一个轴作为剖切轴
+    if (leaf_objects.empty())
+      bbox = aabb(left->bounding_box(), right->bounding_box());
+  }
+
+  static shared_ptr<hittable> make_child(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+                                         const bvh_options& opts, build_counters& counts) {
+    auto node = shared_ptr<bvh_node>(new bvh_node());
+    node->build(objects, start, end, opts, counts);
+    counts.nodes.fetch_add(1, std::memory_order_relaxed);
+    return node;
+  }
+
+  // 左右子树操作的是数组中互不重叠的两段，物体足够多时左子树交给线程池并行构建
+  void build_children(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t mid, size_t end,
+                      const bvh_options& opts, build_counters& counts) {
+    if (end - start >= opts.parallel_threshold) {
+      task_group group(thread_pool::shared());
+      group.run([&] { left = make_child(objects, start, mid, opts, counts); });
+      right = make_child(objects, mid, end, opts, counts);
+      group.wait();
+    }
+    else {
+      left = make_child(objects, start, mid, opts, counts);
+      right = make_child(objects, mid, end, opts, counts);
+    }
+  }
+
+  void build_random_median(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+                           const bvh_options& opts, build_counters& counts) {
+    // 旧版用 random_int 随机选轴。子树在线程池里并行构建，用线程各自的随机数状态会让树的形状随调度变化，
+    // 所以改为由节点覆盖的物体区间打散得到，同样的输入总是建出同样的树
+    int axis = static_cast<int>(mix_bits((static_cast<uint64_t>(start) << 32) ^ end) % 3);
     // 根据剖切轴选择相应的比较函数
     auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
 
@@ -38,29 +342,43 @@ public:
       std::sort(objects.begin() + start, objects.begin() + end, comparator);
       // 从数据中间切开，分为左右子树
       auto mid = start + object_span / 2;
-      left = make_shared<bvh_node>(objects, start, mid);
-      right = make_shared<bvh_node>(objects, mid, end);
+      build_children(objects, start, mid, end, opts, counts);
     }
-
-    bbox = aabb(left->bounding_box(), right->bounding_box());
   }
 
-  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-    if (!bbox.hit(r, ray_t))
-      return false;
+  void build_sah(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+                 const bvh_options& opts, build_counters& counts) {
+    size_t object_span = end - start;
 
-    bool hit_left = left->hit(r, ray_t, rec);
-    bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+    aabb bounds;
+    for (size_t i = start; i < end; ++i)
+      bounds = aabb(bounds, objects[i]->bounding_box());
 
-    return hit_left || hit_right;
-  }
+    auto split = find_sah_split(object_span,
+      [&](size_t i) { return objects[start + i]->bounding_box(); },
+      [&](size_t i) { return objects[start + i]->bounding_box().centroid(); }, bounds, opts);
 
-  aabb bounding_box() const override { return bbox; }
+    // 只剩一个物体，或者物体足够少、并且求交全部物体比继续剖分更便宜时，做成一个叶子
+    if (object_span == 1 || (object_span <= opts.leaf_capacity() && split.cost >= object_span)) {
+      leaf_objects.assign(objects.begin() + start, objects.begin() + end);
+      counts.leaf_slots.fetch_add(leaf_objects.capacity(), std::memory_order_relaxed);
+      bbox = bounds;
+      return;
+    }
 
-private:
-  shared_ptr<hittable> left;
-  shared_ptr<hittable> right;
-  aabb bbox;
+    size_t mid;
+    if (split.axis < 0) {
+      // 所有中心重合，SAH 无法区分，直接从中间切开
+      mid = start + object_span / 2;
+    }
+    else {
+      auto it = std::partition(objects.begin() + start, objects.begin() + end,
+        [&](const shared_ptr<hittable>& object) { return split.goes_left(object->bounding_box().centroid()); });
+      mid = it - objects.begin();
+    }
+
+    build_children(objects, start, mid, end, opts, counts);
+  }
 
   static bool box_compare(
     const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index
@@ -81,4 +399,4 @@ private:
   }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,421 @@
+﻿#ifndef BVH_LINEAR_H
+#define BVH_LINEAR_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere_set.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// 扁平化 BVH 的节点：所有节点按深度优先顺序存放在一个连续数组里，
+// 左孩子紧跟在父节点后面，只需要记录右孩子的下标。一个节点正好占一条 64 字节的缓存行。
+struct alignas(64) linear_bvh_node {
+  double bmin[3];
+  double bmax[3];
+  int32_t offset;  // 叶子：第一个物体在 primitives 中的下标；内部节点：右孩子的下标
+  uint16_t count;  // 叶子中的物体数，内部节点为 0
+  uint8_t axis;    // 内部节点的剖分轴
+  uint8_t pad;
+};
+
+class linear_bvh : public hittable {
+public:
+  linear_bvh(const hittable_list& list, const bvh_options& opts = bvh_options())
+    : linear_bvh(list.objects, opts) {}
+
+  linear_bvh(const std::vector<shared_ptr<hittable>>& objects, const bvh_options& opts = bvh_options()) {
+    build(objects, opts);
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    if (nodes.empty())
+      return false;
+
+    // 每条光线只求一次方向的倒数，所有节点的 slab 测试共用
+    const auto orig = r.origin();
+    const auto dir = r.direction();
+    const double inv_dir[3] = { 1 / dir[0], 1 / dir[1], 1 / dir[2] };
+    const int dir_is_neg[3] = { inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0 };
+
+    bool hit_anything = false;
+    int stack[stack_size];
+    int stack_top = 0;
+    int current = 0;
+
+    while (true) {
+      const auto& node = nodes[current];
+
+      // ray_t.max 随着找到更近的交点而缩小，比当前最近交点还远的节点会直接被跳过
+      if (hit_node(node, orig, inv_dir, ray_t)) {
+        if (node.count > 0) {
+          for (int i = 0; i < node.count; ++i) {
+            if (primitives[node.offset + i]->hit(r, ray_t, rec)) {
+              hit_anything = true;
+              ray_t.max = rec.t;
+            }
+          }
+        }
+        else if (dir_is_neg[node.axis]) {
+          // 光线沿剖分轴的负方向前进，先访问右(远端坐标较大的)孩子
+          stack[stack_top++] = current + 1;
+          current = node.offset;
+          continue;
+        }
+        else {
+          stack[stack_top++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+
+      if (stack_top == 0)
+        break;
+      current = stack[--stack_top];
+    }
+
+    return hit_anything;
+  }
+
+  // 整包遍历：每个节点一次测试包内所有光线，只要还有光线命中就继续向下；
+  // 叶子中的物体只对命中该叶子的光线求交
+  void hit_packet(ray_packet& packet, hit_record* rec) const override {
+    if (nodes.empty() || packet.active == 0)
+      return;
+
+    double inv_x[ray_packet::max_size], inv_y[ray_packet::max_size], inv_z[ray_packet::max_size];
+    for (int i = 0; i < packet.size; ++i) {
+      inv_x[i] = 1 / packet.dx[i];
+      inv_y[i] = 1 / packet.dy[i];
+      inv_z[i] = 1 / packet.dz[i];
+    }
+
+    // 相干光线的方向基本一致，用第一条活跃光线的方向决定先访问哪个孩子
+    const uint32_t active = packet.active;
+    const int first = lowest_set_bit(active);
+    const int dir_is_neg[3] = { inv_x[first] < 0, inv_y[first] < 0, inv_z[first] < 0 };
+
+    int stack[stack_size];
+    int stack_top = 0;
+    int current = 0;
+
+    while (true) {
+      const auto& node = nodes[current];
+      uint32_t mask = hit_node_packet(node, packet, inv_x, inv_y, inv_z) & active;
+
+      if (mask) {
+        if (node.count > 0) {
+          packet.active = mask;
+          for (int i = 0; i < node.count; ++i)
+            primitives[node.offset + i]->hit_packet(packet, rec);
+          packet.active = active;
+        }
+        else if (dir_is_neg[node.axis]) {
+          stack[stack_top++] = current + 1;
+          current = node.offset;
+          continue;
+        }
+        else {
+          stack[stack_top++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+
+      if (stack_top == 0)
+        break;
+      current = stack[--stack_top];
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    for (const auto& object : primitives)
+      object->gather_lights(lights);
+  }
+
+  bool stochastic_hit() const override {
+    for (const auto& object : primitives)
+      if (object->stochastic_hit())
+        return true;
+    return false;
+  }
+
+  // 物体移动后保持树的结构，自底向上重算包围盒：节点按深度优先顺序存放，孩子的下标总比父节点大，
+  // 倒序扫一遍即可。叶子中的物体(合并出的 sphere_set 等)先各自 refit
+  void refit() override {
+    for (auto& object : primitives)
+      object->refit();
+
+    for (size_t i = nodes.size(); i-- > 0;) {
+      auto& node = nodes[i];
+      auto b = build_bounds::empty();
+      if (node.count > 0) {
+        for (int k = 0; k < node.count; ++k)
+          b.grow(primitives[node.offset + k]->bounding_box());
+      }
+      else {
+        for (int c : { static_cast<int>(i) + 1, node.offset }) {
+          const auto& child = nodes[c];
+          for (int a = 0; a < 3; ++a) {
+            b.lo[a] = fmin(b.lo[a], child.bmin[a]);
+            b.hi[a] = fmax(b.hi[a], child.bmax[a]);
+          }
+        }
+      }
+      for (int a = 0; a < 3; ++a) {
+        node.bmin[a] = b.lo[a];
+        node.bmax[a] = b.hi[a];
+      }
+    }
+
+    if (!nodes.empty()) {
+      const auto& root = nodes[0];
+      bbox = aabb(point3(root.bmin[0], root.bmin[1], root.bmin[2]), point3(root.bmax[0], root.bmax[1], root.bmax[2]));
+    }
+  }
+
+  // 树的 SAH 代价：每个节点的表面积相对根节点的比例，内部节点乘遍历代价，叶子乘物体数。
+  // refit 之后和刚构建时比较，代价涨得太多说明包围盒已经严重重叠，应该重建
+  double sah_cost(double traversal_cost = bvh_options().traversal_cost) const {
+    if (nodes.empty())
+      return 0;
+
+    auto area = [](const linear_bvh_node& n) {
+      auto dx = n.bmax[0] - n.bmin[0], dy = n.bmax[1] - n.bmin[1], dz = n.bmax[2] - n.bmin[2];
+      return 2 * (dx * dy + dy * dz + dz * dx);
+    };
+    auto root_area = area(nodes[0]);
+    if (root_area <= 0)
+      return 0;
+
+    double cost = 0;
+    for (const auto& node : nodes)
+      cost += area(node) * (node.count > 0 ? node.count : traversal_cost);
+    return cost / root_area;
+  }
+
+  size_t node_count() const { return nodes.size(); }
+
+  const bvh_build_stats& build_stats() const { return stats; }
+
+  // 供 wide_bvh 等由二叉树转换而来的结构读取
+  const std::vector<linear_bvh_node>& flat_nodes() const { return nodes; }
+  const std::vector<shared_ptr<hittable>>& ordered_primitives() const { return primitives; }
+
+private:
+  // 构建时每个物体的信息，包围盒只取一次，避免反复虚函数调用
+  struct primitive_info {
+    aabb box;
+    point3 centroid;
+    size_t index;
+  };
+
+  static const int stack_size = 128;
+  static const int max_sah_depth = 64; // 超过这个深度改为中间切分，保证遍历栈不会溢出
+
+  std::vector<linear_bvh_node> nodes;
+  std::vector<shared_ptr<hittable>> primitives; // 按叶子顺序重新排列后的物体
+  aabb bbox;
+  bvh_build_stats stats;
+
+  static bool hit_node(const linear_bvh_node& node, const point3& orig, const double* inv_dir, interval ray_t) {
+    for (int a = 0; a < 3; a++) {
+      auto t0 = (node.bmin[a] - orig[a]) * inv_dir[a];
+      auto t1 = (node.bmax[a] - orig[a]) * inv_dir[a];
+
+      if (inv_dir[a] < 0)
+        std::swap(t0, t1);
+
+      if (t0 > ray_t.min) ray_t.min = t0;
+      if (t1 < ray_t.max) ray_t.max = t1;
+
+      if (ray_t.max <= ray_t.min)
+        return false;
+    }
+    return true;
+  }
+
+  // 包内各光线的 slab 测试写成对 SoA 数组的同一循环，编译器可以向量化；返回命中的光线掩码
+  static uint32_t hit_node_packet(const linear_bvh_node& node, const ray_packet& packet,
+                                  const double* inv_x, const double* inv_y, const double* inv_z) {
+    uint32_t mask = 0;
+    for (int i = 0; i < packet.size; ++i) {
+      double t_near = packet.tmin[i], t_far = packet.tmax[i];
+      slab(node.bmin[0], node.bmax[0], packet.ox[i], inv_x[i], t_near, t_far);
+      slab(node.bmin[1], node.bmax[1], packet.oy[i], inv_y[i], t_near, t_far);
+      slab(node.bmin[2], node.bmax[2], packet.oz[i], inv_z[i], t_near, t_far);
+      mask |= static_cast<uint32_t>(t_near < t_far) << i;
+    }
+    return mask;
+  }
+
+  static void slab(double lo, double hi, double orig, double inv, double& t_near, double& t_far) {
+    auto t0 = (lo - orig) * inv;
+    auto t1 = (hi - orig) * inv;
+    auto tn = inv < 0 ? t1 : t0;
+    auto tf = inv < 0 ? t0 : t1;
+    t_near = tn > t_near ? tn : t_near;
+    t_far = tf < t_far ? tf : t_far;
+  }
+
+  void build(const std::vector<shared_ptr<hittable>>& objects, const bvh_options& opts) {
+    if (objects.empty())
+      return;
+
+    auto build_start = std::chrono::steady_clock::now();
+    size_t n = objects.size();
+
+    // 所有递归层共用这一个数组，原地划分；叶子的物体正好是其中连续的一段
+    std::vector<primitive_info> info(n);
+    for (size_t i = 0; i < n; ++i) {
+      info[i].box = objects[i]->bounding_box();
+      info[i].centroid = info[i].box.centroid();
+      info[i].index = i;
+    }
+
+    // n 个物体的子树最多 2n-1 个节点：根节点占第 0 格，左子树从第 1 格开始，
+    // 右子树从 2*左边物体数 的位置开始，各子树写入互不重叠的位置，可以并行构建
+    std::vector<linear_bvh_node> slots(2 * n - 1);
+    std::vector<uint8_t> used(2 * n - 1, 0);
+    build_recursive(info, slots, used, 0, 0, n, 0, opts);
+
+    // 去掉叶子容纳多个物体留下的空位：空位只会出现在子树末尾，删掉后仍是深度优先顺序
+    std::vector<int32_t> remap(slots.size());
+    size_t count = 0;
+    for (size_t i = 0; i < slots.size(); ++i)
+      if (used[i]) remap[i] = static_cast<int32_t>(count++);
+
+    nodes.resize(count);
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (!used[i]) continue;
+      auto& node = nodes[remap[i]];
+      node = slots[i];
+      if (node.count == 0)
+        node.offset = remap[node.offset];
+    }
+
+    primitives.resize(n);
+    for (size_t i = 0; i < n; ++i)
+      primitives[i] = objects[info[i].index];
+    if (opts.pack_spheres)
+      pack_sphere_leaves();
+
+    const auto& root = nodes[0];
+    bbox = aabb(point3(root.bmin[0], root.bmin[1], root.bmin[2]), point3(root.bmax[0], root.bmax[1], root.bmax[2]));
+
+    stats.build_ms = elapsed_ms(build_start);
+    stats.primitive_count = n;
+    stats.node_count = nodes.size();
+    stats.memory_bytes = nodes.size() * sizeof(linear_bvh_node) + primitives.size() * sizeof(shared_ptr<hittable>);
+    stats.peak_build_bytes = stats.memory_bytes + n * sizeof(primitive_info)
+      + slots.size() * (sizeof(linear_bvh_node) + sizeof(uint8_t) + sizeof(int32_t));
+    if (opts.report)
+      stats.print("linear_bvh");
+  }
+
+  // 全是球的叶子换成一个 sphere_set，一次 SIMD 求交整片叶子；只有两个球时省下的不够抵消额外的一次调用，保持原样。
+  // 叶子按深度优先顺序引用连续的物体，依次重写 offset 即可
+  void pack_sphere_leaves() {
+    std::vector<shared_ptr<hittable>> packed;
+    packed.reserve(primitives.size());
+
+    for (auto& node : nodes) {
+      if (node.count == 0)
+        continue;
+
+      auto first = primitives.begin() + node.offset;
+      auto last = first + node.count;
+      bool all_spheres = node.count > 2
+        && std::all_of(first, last, [](const shared_ptr<hittable>& p) { return sphere_set::can_hold(*p); });
+
+      node.offset = static_cast<int32_t>(packed.size());
+      if (all_spheres) {
+        packed.push_back(make_shared<sphere_set>(std::vector<shared_ptr<hittable>>(first, last)));
+        node.count = 1;
+      }
+      else {
+        packed.insert(packed.end(), first, last);
+      }
+    }
+
+    primitives.swap(packed);
+  }
+
+  // 构建 info[start, end) 的子树，根节点写入 slots[slot]
+  void build_recursive(std::vector<primitive_info>& info, std::vector<linear_bvh_node>& slots,
+                       std::vector<uint8_t>& used, size_t slot, size_t start, size_t end, int depth,
+                       const bvh_options& opts) {
+    auto& node = slots[slot];
+    used[slot] = 1;
+
+    auto b = build_bounds::empty();
+    for (size_t i = start; i < end; ++i)
+      b.grow(info[i].box);
+
+    for (int a = 0; a < 3; ++a) {
+      node.bmin[a] = b.lo[a];
+      node.bmax[a] = b.hi[a];
+    }
+    aabb bounds(point3(b.lo[0], b.lo[1], b.lo[2]), point3(b.hi[0], b.hi[1], b.hi[2]));
+
+    size_t span = end - start;
+    sah_split split;
+    if (span > 1 && depth < max_sah_depth && opts.split == bvh_split::sah)
+      split = find_sah_split(span,
+        [&](size_t i) -> const aabb& { return info[start + i].box; },
+        [&](size_t i) -> const point3& { return info[start + i].centroid; }, bounds, opts);
+
+    bool make_leaf = span == 1
+      || (span <= opts.leaf_capacity() && split.cost >= span);
+    if (make_leaf) {
+      node.offset = static_cast<int32_t>(start);
+      node.count = static_cast<uint16_t>(span);
+      return;
+    }
+
+    size_t mid;
+    int axis;
+    if (split.axis >= 0) {
+      axis = split.axis;
+      auto it = std::partition(info.begin() + start, info.begin() + end,
+        [&](const primitive_info& p) { return split.goes_left(p.centroid); });
+      mid = it - info.begin();
+    }
+    else {
+      // SAH 无法区分(或不使用 SAH)时，沿包围盒最长的轴从中间切开
+      axis = 0;
+      for (int a = 1; a < 3; ++a)
+        if (bounds.axis(a).size() > bounds.axis(axis).size()) axis = a;
+      mid = start + span / 2;
+      std::nth_element(info.begin() + start, info.begin() + mid, info.begin() + end,
+        [axis](const primitive_info& a, const primitive_info& b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    size_t left_slot = slot + 1;
+    size_t right_slot = slot + 2 * (mid - start);
+    node.offset = static_cast<int32_t>(right_slot);
+    node.count = 0;
+    node.axis = static_cast<uint8_t>(axis);
+
+    if (span >= opts.parallel_threshold) {
+      task_group group(thread_pool::shared());
+      group.run([&, left_slot, start, mid, depth] {
+        build_recursive(info, slots, used, left_slot, start, mid, depth + 1, opts);
+      });
+      build_recursive(info, slots, used, right_slot, mid, end, depth + 1, opts);
+      group.wait();
+    }
+    else {
+      build_recursive(info, slots, used, left_slot, start, mid, depth + 1, opts);
+      build_recursive(info, slots, used, right_slot, mid, end, depth + 1, opts);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,614 @@
+﻿#ifndef BVH_MOTION_H
+#define BVH_MOTION_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "simd.h"
+#include "sphere_set.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// 运动模糊 BVH 的节点：保存节点时间区间起点和终点的两个包围盒，遍历时按光线的时间线性插值。
+// 普通 BVH 用覆盖整条轨迹的包围盒，移动快的物体会让节点互相重叠；插值后的包围盒只比该时刻的物体略大。
+// 包围盒用单精度并向外取整，一个节点正好占一条 64 字节的缓存行
+struct alignas(64) motion_bvh_node {
+  float bmin0[3], bmax0[3]; // 时间区间起点的包围盒
+  float bmin1[3], bmax1[3]; // 时间区间终点的包围盒
+  float time0;       // 节点的时间区间 [time0, time0 + 1 / time_scale]
+  float time_scale;
+  int32_t offset;    // 叶子：第一个物体在 primitives 中的下标；内部节点：右孩子的下标
+  uint16_t count;    // 叶子中的物体数，内部节点为 0
+  uint8_t axis;      // 内部节点的剖分轴
+  uint8_t time_split; // 为 1 时两个孩子各管时间区间的前一半和后一半，物体相同
+};
+
+// 针对移动物体(目前是移动的球)的 BVH。每个节点的包围盒随时间插值；
+// 移动得太快、插值后的包围盒仍然明显偏大时，把时间区间对半分开，两半各建一棵子树(物体在两棵子树中都出现)。
+// 遍历时的时间划分节点只进入光线时间所在的那一半，不需要压栈。
+// 时间划分会复制子树，构建按深度优先顺序逐个追加节点，不像 linear_bvh 那样并行
+class motion_bvh : public hittable {
+public:
+  motion_bvh(const hittable_list& list, const bvh_options& opts = bvh_options())
+    : motion_bvh(list.objects, opts) {}
+
+  motion_bvh(const std::vector<shared_ptr<hittable>>& objects, const bvh_options& opts = bvh_options()) {
+    build(objects, opts);
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    if (nodes.empty())
+      return false;
+
+    const auto dir = r.direction();
+    const double time = r.time();
+    const node_ray nr(r);
+    const int dir_is_neg[3] = { dir[0] < 0, dir[1] < 0, dir[2] < 0 };
+
+    bool hit_anything = false;
+    int stack[stack_size];
+    int stack_top = 0;
+    int current = 0;
+
+    while (true) {
+      const auto& node = nodes[current];
+
+      if (hit_node(node, nr, time, ray_t)) {
+        if (node.count > 0) {
+          for (int i = 0; i < node.count; ++i) {
+            if (primitives[node.offset + i]->hit(r, ray_t, rec)) {
+              hit_anything = true;
+              ray_t.max = rec.t;
+            }
+          }
+        }
+        else if (node.time_split) {
+          current = time_fraction(node, time) < 0.5 ? current + 1 : node.offset;
+          continue;
+        }
+        else if (dir_is_neg[node.axis]) {
+          stack[stack_top++] = current + 1;
+          current = node.offset;
+          continue;
+        }
+        else {
+          stack[stack_top++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+
+      if (stack_top == 0)
+        break;
+      current = stack[--stack_top];
+    }
+
+    return hit_anything;
+  }
+
+  // 包内光线的时间各不相同，每条光线用自己的时间插值包围盒；
+  // 时间划分节点把包按时间分成两组，栈里同时记下节点和还要继续遍历的光线
+  void hit_packet(ray_packet& packet, hit_record* rec) const override {
+    if (nodes.empty() || packet.active == 0)
+      return;
+
+    packet_rays rays(packet);
+
+    // 相干光线的方向基本一致，用第一条活跃光线的方向决定先访问哪个孩子
+    const uint32_t active = packet.active;
+    const int first = lowest_set_bit(active);
+    const int dir_is_neg[3] = { packet.dx[first] < 0, packet.dy[first] < 0, packet.dz[first] < 0 };
+
+    int stack[stack_size];
+    uint32_t stack_mask[stack_size];
+    int stack_top = 0;
+    int current = 0;
+    uint32_t lanes = active;
+
+    while (true) {
+      const auto& node = nodes[current];
+      uint32_t mask = hit_node_packet(node, rays, packet, lanes);
+
+      if (mask) {
+        if (node.count > 0) {
+          packet.active = mask;
+          for (int i = 0; i < node.count; ++i)
+            primitives[node.offset + i]->hit_packet(packet, rec);
+          packet.active = active;
+          rays.update(packet, mask);
+        }
+        else if (node.time_split) {
+          uint32_t early = 0;
+          for (uint32_t m = mask; m; m &= m - 1) {
+            int i = lowest_set_bit(m);
+            if (time_fraction(node, packet.time[i]) < 0.5)
+              early |= 1u << i;
+          }
+          uint32_t late = mask & ~early;
+          if (early && late) {
+            stack[stack_top] = node.offset;
+            stack_mask[stack_top++] = late;
+          }
+          current = early ? current + 1 : node.offset;
+          lanes = early ? early : late;
+          continue;
+        }
+        else {
+          stack[stack_top] = dir_is_neg[node.axis] ? current + 1 : node.offset;
+          stack_mask[stack_top++] = mask;
+          current = dir_is_neg[node.axis] ? node.offset : current + 1;
+          lanes = mask;
+          continue;
+        }
+      }
+
+      if (stack_top == 0)
+        break;
+      --stack_top;
+      current = stack[stack_top];
+      lanes = stack_mask[stack_top];
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  void motion_bounds(aabb& start, aabb& end) const override {
+    start = bbox0;
+    end = bbox1;
+  }
+
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    for (const auto& object : originals)
+      object->gather_lights(lights);
+  }
+
+  bool stochastic_hit() const override {
+    for (const auto& object : originals)
+      if (object->stochastic_hit())
+        return true;
+    return false;
+  }
+
+  size_t node_count() const { return nodes.size(); }
+
+  const bvh_build_stats& build_stats() const { return stats; }
+
+private:
+  // 构建时每个物体的信息：时间 0 和 1 的包围盒，当前节点时间区间两端的包围盒，以及区间中点的中心
+  struct primitive_info {
+    aabb box0, box1;
+    aabb start, end;
+    point3 centroid;
+    size_t index;
+  };
+
+  static const int stack_size = 128;
+  static const int max_sah_depth = 64;
+
+  std::vector<motion_bvh_node> nodes;
+  std::vector<shared_ptr<hittable>> primitives; // 叶子引用的物体，时间划分后同一物体可能出现多次
+  std::vector<shared_ptr<hittable>> originals;  // 构建时传入的物体，每个只出现一次，用于收集光源
+  aabb bbox, bbox0, bbox1;
+  double pad = 0; // 单精度包围盒向外扩张的距离，覆盖插值和光线原点转换成 float 的舍入误差
+  size_t time_splits = 0;
+  size_t copied = 0, peak_copied = 0; // 构建时为时间划分复制的物体信息条数(当前、最多)
+  bvh_build_stats stats;
+
+  static double time_fraction(const motion_bvh_node& node, double time) {
+    auto s = (time - node.time0) * node.time_scale;
+    return s < 0 ? 0 : (s > 1 ? 1 : s);
+  }
+
+  static double lerp(float a, float b, double s) { return a + (static_cast<double>(b) - a) * s; }
+
+  // 单条光线做盒子测试要用的原点和方向倒数，每条光线只准备一次。
+  // SSE 版本把三个轴放在寄存器的前三个分量，第四个分量的原点和倒数为 0，算出的 t 恒为 0，最后不参与比较
+  struct node_ray {
+#if RT_SIMD_X86
+    __m128 org4, inv4;
+#else
+    double orig[3];
+    double inv_dir[3];
+#endif
+
+    node_ray() {}
+
+    explicit node_ray(const ray& r) {
+      const auto& o = r.origin();
+      const auto& d = r.direction();
+#if RT_SIMD_X86
+      org4 = _mm_setr_ps(static_cast<float>(o[0]), static_cast<float>(o[1]), static_cast<float>(o[2]), 0);
+      inv4 = _mm_setr_ps(static_cast<float>(1 / d[0]), static_cast<float>(1 / d[1]), static_cast<float>(1 / d[2]), 0);
+#else
+      for (int a = 0; a < 3; ++a) {
+        orig[a] = o[a];
+        inv_dir[a] = 1 / d[a];
+      }
+#endif
+    }
+  };
+
+  static bool hit_node(const motion_bvh_node& node, const node_ray& r, double time, const interval& ray_t) {
+#if RT_SIMD_X86
+    // 单精度插值和光线原点的舍入由构建时的 pad 覆盖，和 wide_bvh 相同
+    __m128 s = _mm_set1_ps(static_cast<float>(time_fraction(node, time)));
+    __m128 lo0 = _mm_loadu_ps(node.bmin0), lo1 = _mm_loadu_ps(node.bmin1);
+    __m128 hi0 = _mm_loadu_ps(node.bmax0), hi1 = _mm_loadu_ps(node.bmax1);
+    __m128 lo = _mm_add_ps(lo0, _mm_mul_ps(s, _mm_sub_ps(lo1, lo0)));
+    __m128 hi = _mm_add_ps(hi0, _mm_mul_ps(s, _mm_sub_ps(hi1, hi0)));
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, r.org4), r.inv4);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, r.org4), r.inv4);
+    __m128 tn = _mm_min_ps(t0, t1);
+    __m128 tf = _mm_max_ps(t0, t1);
+    tn = _mm_max_ss(_mm_max_ss(tn, _mm_shuffle_ps(tn, tn, _MM_SHUFFLE(1, 1, 1, 1))),
+                    _mm_max_ss(_mm_shuffle_ps(tn, tn, _MM_SHUFFLE(2, 2, 2, 2)), _mm_set_ss(static_cast<float>(ray_t.min))));
+    tf = _mm_min_ss(_mm_min_ss(tf, _mm_shuffle_ps(tf, tf, _MM_SHUFFLE(1, 1, 1, 1))),
+                    _mm_min_ss(_mm_shuffle_ps(tf, tf, _MM_SHUFFLE(2, 2, 2, 2)), _mm_set_ss(static_cast<float>(ray_t.max))));
+    return _mm_comile_ss(tn, tf);
+#else
+    auto s = time_fraction(node, time);
+    double t_near = ray_t.min, t_far = ray_t.max;
+    for (int a = 0; a < 3; a++)
+      slab(lerp(node.bmin0[a], node.bmin1[a], s), lerp(node.bmax0[a], node.bmax1[a], s), r.orig[a], r.inv_dir[a],
+           t_near, t_far);
+    return t_near < t_far;
+#endif
+  }
+
+  // 光线包的盒子测试数据。SSE 版本按 SoA 存成单精度，一次测试 4 条光线；
+  // 凑不满 4 条的空位 tmin > tmax，永远不命中。tmax 在叶子求交后用 update 同步
+  struct packet_rays {
+#if RT_SIMD_X86
+    alignas(16) float org[3][ray_packet::max_size];
+    alignas(16) float inv_dir[3][ray_packet::max_size];
+    alignas(16) float time[ray_packet::max_size];
+    alignas(16) float tmin[ray_packet::max_size];
+    alignas(16) float tmax[ray_packet::max_size];
+
+    explicit packet_rays(const ray_packet& packet) {
+      for (int i = 0; i < ray_packet::max_size; ++i) {
+        bool used = i < packet.size;
+        org[0][i] = used ? static_cast<float>(packet.ox[i]) : 0;
+        org[1][i] = used ? static_cast<float>(packet.oy[i]) : 0;
+        org[2][i] = used ? static_cast<float>(packet.oz[i]) : 0;
+        inv_dir[0][i] = used ? static_cast<float>(1 / packet.dx[i]) : 0;
+        inv_dir[1][i] = used ? static_cast<float>(1 / packet.dy[i]) : 0;
+        inv_dir[2][i] = used ? static_cast<float>(1 / packet.dz[i]) : 0;
+        time[i] = used ? static_cast<float>(packet.time[i]) : 0;
+        tmin[i] = used ? static_cast<float>(packet.tmin[i]) : 1;
+        tmax[i] = used ? static_cast<float>(packet.tmax[i]) : 0;
+      }
+    }
+
+    void update(const ray_packet& packet, uint32_t mask) {
+      for (uint32_t m = mask; m; m &= m - 1) {
+        int i = lowest_set_bit(m);
+        tmax[i] = static_cast<float>(packet.tmax[i]);
+      }
+    }
+#else
+    node_ray lane[ray_packet::max_size];
+
+    explicit packet_rays(const ray_packet& packet) {
+      for (int i = 0; i < packet.size; ++i)
+        lane[i] = node_ray(packet.get(i));
+    }
+
+    void update(const ray_packet&, uint32_t) {}
+#endif
+  };
+
+  static uint32_t hit_node_packet(const motion_bvh_node& node, const packet_rays& rays, const ray_packet& packet,
+                                  uint32_t lanes) {
+    uint32_t mask = 0;
+#if RT_SIMD_X86
+    const __m128 time0 = _mm_set1_ps(node.time0);
+    const __m128 time_scale = _mm_set1_ps(node.time_scale);
+    for (int g = 0; g < packet.size; g += 4) {
+      if (((lanes >> g) & 0xf) == 0)
+        continue;
+
+      __m128 s = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(rays.time + g), time0), time_scale);
+      s = _mm_min_ps(_mm_max_ps(s, _mm_setzero_ps()), _mm_set1_ps(1));
+      __m128 t_near = _mm_load_ps(rays.tmin + g);
+      __m128 t_far = _mm_load_ps(rays.tmax + g);
+      for (int a = 0; a < 3; ++a) {
+        __m128 lo = _mm_add_ps(_mm_set1_ps(node.bmin0[a]), _mm_mul_ps(s, _mm_set1_ps(node.bmin1[a] - node.bmin0[a])));
+        __m128 hi = _mm_add_ps(_mm_set1_ps(node.bmax0[a]), _mm_mul_ps(s, _mm_set1_ps(node.bmax1[a] - node.bmax0[a])));
+        __m128 o = _mm_load_ps(rays.org[a] + g);
+        __m128 inv = _mm_load_ps(rays.inv_dir[a] + g);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, o), inv);
+        t_near = _mm_max_ps(t_near, _mm_min_ps(t0, t1));
+        t_far = _mm_min_ps(t_far, _mm_max_ps(t0, t1));
+      }
+      mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) << g;
+    }
+#else
+    for (uint32_t m = lanes; m; m &= m - 1) {
+      int i = lowest_set_bit(m);
+      if (hit_node(node, rays.lane[i], packet.time[i], interval(packet.tmin[i], packet.tmax[i])))
+        mask |= 1u << i;
+    }
+#endif
+    return mask & lanes;
+  }
+
+  static void slab(double lo, double hi, double orig, double inv, double& t_near, double& t_far) {
+    auto t0 = (lo - orig) * inv;
+    auto t1 = (hi - orig) * inv;
+    auto tn = inv < 0 ? t1 : t0;
+    auto tf = inv < 0 ? t0 : t1;
+    t_near = tn > t_near ? tn : t_near;
+    t_far = tf < t_far ? tf : t_far;
+  }
+
+  static float round_down(double d) {
+    auto f = static_cast<float>(d);
+    return (f > d) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+  }
+
+  static float round_up(double d) {
+    auto f = static_cast<float>(d);
+    return (f < d) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+  }
+
+  // 物体在时刻 t 的包围盒：两端包围盒的线性插值
+  static aabb box_at(const primitive_info& p, double t) {
+    auto lo = [&](int a) { return p.box0.axis(a).min + (p.box1.axis(a).min - p.box0.axis(a).min) * t; };
+    auto hi = [&](int a) { return p.box0.axis(a).max + (p.box1.axis(a).max - p.box0.axis(a).max) * t; };
+    return aabb(point3(lo(0), lo(1), lo(2)), point3(hi(0), hi(1), hi(2)));
+  }
+
+  static build_bounds bounds_at(const std::vector<primitive_info>& info, size_t start, size_t end, double t) {
+    auto b = build_bounds::empty();
+    for (size_t i = start; i < end; ++i)
+      b.grow(box_at(info[i], t));
+    return b;
+  }
+
+  // 节点在两端包围盒之间插值，时间区间中点处包围盒的表面积
+  static double lerped_area(const build_bounds& a, const build_bounds& b) {
+    build_bounds mid;
+    for (int k = 0; k < 3; ++k) {
+      mid.lo[k] = 0.5 * (a.lo[k] + b.lo[k]);
+      mid.hi[k] = 0.5 * (a.hi[k] + b.hi[k]);
+    }
+    return mid.surface_area();
+  }
+
+  void build(const std::vector<shared_ptr<hittable>>& objects, const bvh_options& opts) {
+    if (objects.empty())
+      return;
+
+    auto build_start = std::chrono::steady_clock::now();
+    size_t n = objects.size();
+    originals = objects;
+
+    std::vector<primitive_info> info(n);
+    for (size_t i = 0; i < n; ++i) {
+      objects[i]->motion_bounds(info[i].box0, info[i].box1);
+      info[i].index = i;
+    }
+
+    auto b0 = bounds_at(info, 0, n, 0);
+    auto b1 = bounds_at(info, 0, n, 1);
+    bbox0 = aabb(point3(b0.lo[0], b0.lo[1], b0.lo[2]), point3(b0.hi[0], b0.hi[1], b0.hi[2]));
+    bbox1 = aabb(point3(b1.lo[0], b1.lo[1], b1.lo[2]), point3(b1.hi[0], b1.hi[1], b1.hi[2]));
+    bbox = aabb(bbox0, bbox1);
+
+    double extent = 1;
+    for (int a = 0; a < 3; ++a)
+      extent = fmax(extent, fmax(fabs(bbox.axis(a).min), fabs(bbox.axis(a).max)));
+    pad = extent * (1.0 / (1 << 18));
+
+    nodes.reserve(2 * n);
+    primitives.reserve(n);
+    build_recursive(info, 0, n, 0, 1, 0, 0, opts);
+
+    stats.build_ms = elapsed_ms(build_start);
+    stats.primitive_count = n;
+    stats.node_count = nodes.size();
+    stats.memory_bytes = nodes.size() * sizeof(motion_bvh_node) + primitives.size() * sizeof(shared_ptr<hittable>);
+    stats.peak_build_bytes = stats.memory_bytes + (n + peak_copied) * sizeof(primitive_info);
+    if (opts.report) {
+      stats.print("motion_bvh");
+      std::clog << "motion_bvh: " << time_splits << " time splits\n";
+    }
+  }
+
+  // 构建 info[start, end) 在时间区间 [t0, t1] 上的子树，返回根节点的下标。
+  // 节点按深度优先顺序追加，左孩子紧跟在父节点后面
+  int build_recursive(std::vector<primitive_info>& info, size_t start, size_t end, double t0, double t1,
+                      int splits, int depth, const bvh_options& opts) {
+    int index = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+
+    auto b0 = bounds_at(info, start, end, t0);
+    auto b1 = bounds_at(info, start, end, t1);
+    {
+      auto& node = nodes[index];
+      for (int a = 0; a < 3; ++a) {
+        node.bmin0[a] = round_down(b0.lo[a] - pad);
+        node.bmax0[a] = round_up(b0.hi[a] + pad);
+        node.bmin1[a] = round_down(b1.lo[a] - pad);
+        node.bmax1[a] = round_up(b1.hi[a] + pad);
+      }
+      node.time0 = static_cast<float>(t0);
+      node.time_scale = static_cast<float>(1 / (t1 - t0));
+      node.time_split = 0;
+    }
+
+    auto tm = 0.5 * (t0 + t1);
+    for (size_t i = start; i < end; ++i) {
+      info[i].start = box_at(info[i], t0);
+      info[i].end = box_at(info[i], t1);
+      info[i].centroid = box_at(info[i], tm).centroid();
+    }
+    auto area = lerped_area(b0, b1);
+
+    size_t span = end - start;
+    sah_split split;
+    if (span > 1 && depth < max_sah_depth && opts.split == bvh_split::sah)
+      split = find_motion_split(info, start, end, area, opts);
+
+    // 时间划分：两半的物体数不变，只有包围盒变小。代价和物体划分按同样的 SAH 比较，
+    // 静止的物体两半的包围盒和原来相同，永远不会选中
+    double time_cost = infinity;
+    if (span > 1 && splits < opts.max_time_splits && depth < max_sah_depth && area > 0) {
+      auto bm = bounds_at(info, start, end, tm);
+      time_cost = opts.traversal_cost + span * (lerped_area(b0, bm) + lerped_area(bm, b1)) / (2 * area);
+    }
+
+    auto best = fmin(split.cost, time_cost);
+    if (span == 1 || (span <= opts.leaf_capacity() && best >= span)) {
+      make_leaf(nodes[index], info, start, end, opts);
+      return index;
+    }
+
+    if (time_cost < split.cost) {
+      ++time_splits;
+      nodes[index].time_split = 1;
+      nodes[index].axis = 0;
+
+      // 左子树原地重排 info[start, end)，右子树需要一份原样的副本
+      std::vector<primitive_info> late(info.begin() + start, info.begin() + end);
+      copied += span;
+      peak_copied = std::max(peak_copied, copied);
+      build_recursive(info, start, end, t0, tm, splits + 1, depth + 1, opts);
+      int right = build_recursive(late, 0, late.size(), tm, t1, splits + 1, depth + 1, opts);
+      copied -= span;
+      nodes[index].offset = right;
+      nodes[index].count = 0;
+      return index;
+    }
+
+    size_t mid;
+    int axis;
+    if (split.axis >= 0) {
+      axis = split.axis;
+      auto it = std::partition(info.begin() + start, info.begin() + end,
+        [&](const primitive_info& p) { return split.goes_left(p.centroid); });
+      mid = it - info.begin();
+    }
+    else {
+      axis = 0;
+      for (int a = 1; a < 3; ++a)
+        if (b0.hi[a] + b1.hi[a] - b0.lo[a] - b1.lo[a] > b0.hi[axis] + b1.hi[axis] - b0.lo[axis] - b1.lo[axis])
+          axis = a;
+      mid = start + span / 2;
+      std::nth_element(info.begin() + start, info.begin() + mid, info.begin() + end,
+        [axis](const primitive_info& a, const primitive_info& b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    build_recursive(info, start, mid, t0, t1, splits, depth + 1, opts);
+    int right = build_recursive(info, mid, end, t0, t1, splits, depth + 1, opts);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    nodes[index].axis = static_cast<uint8_t>(axis);
+    return index;
+  }
+
+  // 分桶 SAH，和 find_sah_split 相同，只是每个桶累积时间区间两端的两个包围盒，
+  // 子节点的面积取插值包围盒在区间中点的面积。速度不同的物体即使中点位置相近，两端也会分开，
+  // 只看中点的包围盒会低估它们放在一起的代价
+  static sah_split find_motion_split(const std::vector<primitive_info>& info, size_t start, size_t end,
+                                     double area, const bvh_options& opts) {
+    sah_split best;
+    size_t count = end - start;
+
+    auto centroid_bounds = build_bounds::empty();
+    for (size_t i = start; i < end; ++i)
+      centroid_bounds.grow(info[i].centroid);
+
+    const int max_buckets = 32;
+    best.bucket_count = std::max(2, std::min({ opts.sah_buckets, max_buckets, static_cast<int>(std::min<size_t>(count, max_buckets)) }));
+    const int buckets = best.bucket_count;
+
+    for (int axis = 0; axis < 3; ++axis) {
+      auto extent = centroid_bounds.hi[axis] - centroid_bounds.lo[axis];
+      if (!(extent > 0)) continue;
+
+      sah_split candidate = best;
+      candidate.axis = axis;
+      candidate.cmin = centroid_bounds.lo[axis];
+      candidate.cscale = buckets / extent;
+
+      build_bounds box0[max_buckets], box1[max_buckets];
+      int bucket_count[max_buckets];
+      for (int b = 0; b < buckets; ++b) {
+        box0[b] = box1[b] = build_bounds::empty();
+        bucket_count[b] = 0;
+      }
+      for (size_t i = start; i < end; ++i) {
+        int b = candidate.bucket_of(info[i].centroid);
+        box0[b].grow(info[i].start);
+        box1[b].grow(info[i].end);
+        bucket_count[b]++;
+      }
+
+      double right_area[max_buckets];
+      int right_count[max_buckets];
+      auto acc0 = build_bounds::empty(), acc1 = build_bounds::empty();
+      int n = 0;
+      for (int b = buckets - 1; b > 0; --b) {
+        acc0.grow(box0[b]);
+        acc1.grow(box1[b]);
+        n += bucket_count[b];
+        right_area[b] = lerped_area(acc0, acc1);
+        right_count[b] = n;
+      }
+
+      acc0 = acc1 = build_bounds::empty();
+      n = 0;
+      for (int b = 0; b < buckets - 1; ++b) {
+        acc0.grow(box0[b]);
+        acc1.grow(box1[b]);
+        n += bucket_count[b];
+        if (n == 0 || right_count[b + 1] == 0) continue;
+
+        auto cost = opts.traversal_cost
+          + (lerped_area(acc0, acc1) * n + right_area[b + 1] * right_count[b + 1]) / area;
+        if (cost < best.cost) {
+          best = candidate;
+          best.bucket = b;
+          best.cost = cost;
+        }
+      }
+    }
+
+    return best;
+  }
+
+  // 叶子的物体追加到 primitives 末尾；全是球时和 linear_bvh 一样合并为一个 sphere_set
+  void make_leaf(motion_bvh_node& node, const std::vector<primitive_info>& info, size_t start, size_t end,
+                 const bvh_options& opts) {
+    node.offset = static_cast<int32_t>(primitives.size());
+
+    size_t span = end - start;
+    bool all_spheres = opts.pack_spheres && span > 2;
+    for (size_t i = start; i < end && all_spheres; ++i)
+      all_spheres = sphere_set::can_hold(*originals[info[i].index]);
+
+    if (all_spheres) {
+      std::vector<shared_ptr<hittable>> leaf;
+      for (size_t i = start; i < end; ++i)
+        leaf.push_back(originals[info[i].index]);
+      primitives.push_back(make_shared<sphere_set>(leaf));
+      node.count = 1;
+    }
+    else {
+      for (size_t i = start; i < end; ++i)
+        primitives.push_back(originals[info[i].index]);
+      node.count = static_cast<uint16_t>(span);
+    }
+  }
+};
+
+#endif
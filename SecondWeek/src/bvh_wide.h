@@ -0,0 +1,597 @@
+﻿#ifndef BVH_WIDE_H
+#define BVH_WIDE_H
+
+#include "common.h"
+
+#include "bvh_linear.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "simd.h"
+
+#include <cstdint>
+#include <vector>
+
+// 多叉 BVH 的节点：N 个孩子的包围盒按 SoA 存放(单精度)，一次 SIMD 运算同时测试所有孩子
+template <int N>
+struct alignas(64) wide_bvh_node {
+  float bmin[3][N];
+  float bmax[3][N];
+  int32_t child[N];  // 内部节点：子节点下标；叶子：第一个物体的下标；空位：-1
+  uint16_t count[N]; // 叶子中的物体数，内部节点和空位为 0
+};
+
+// 单精度光线，供盒子测试使用
+struct wide_ray {
+  float org[3];
+  float inv_dir[3];
+  int neg[3]; // 各轴方向是否为负：为负时近平面是 bmax
+};
+
+// 单精度的光线包(SoA)，供跨光线的盒子测试使用。不活跃和超出 size 的位置 tmin > tmax，永远不命中
+struct alignas(32) wide_packet {
+  float org[3][ray_packet::max_size];
+  float inv_dir[3][ray_packet::max_size];
+  float tmin[ray_packet::max_size];
+  float tmax[ray_packet::max_size];
+
+  void load(const ray_packet& packet) {
+    for (int i = 0; i < ray_packet::max_size; ++i) {
+      bool used = i < packet.size && (packet.active & (1u << i));
+      double o[3] = { packet.ox[i], packet.oy[i], packet.oz[i] };
+      double d[3] = { packet.dx[i], packet.dy[i], packet.dz[i] };
+      for (int a = 0; a < 3; ++a) {
+        org[a][i] = used ? static_cast<float>(o[a]) : 0.0f;
+        inv_dir[a][i] = used ? static_cast<float>(1 / d[a]) : 1.0f;
+      }
+      tmin[i] = used ? static_cast<float>(packet.tmin[i]) : 1.0f;
+      tmax[i] = used ? static_cast<float>(packet.tmax[i]) : 0.0f;
+    }
+  }
+
+  // 叶子求交缩小了 packet.tmax 之后同步
+  void update(const ray_packet& packet, uint32_t rays) {
+    for (int i = 0; i < packet.size; ++i)
+      if (rays & (1u << i))
+        tmax[i] = static_cast<float>(packet.tmax[i]);
+  }
+};
+
+// 从二叉的 linear_bvh 折叠出的 N 叉 BVH(N = 4 用 SSE，N = 8 用 AVX2)。
+// 盒子测试内核在构造时按 CPU 支持的指令集选择，不支持时退回标量实现。
+template <int N>
+class wide_bvh : public hittable {
+public:
+  explicit wide_bvh(const linear_bvh& binary, simd_level level = detect_simd_level()) {
+    build(binary, level);
+  }
+
+  wide_bvh(const hittable_list& list, const bvh_options& opts = bvh_options(), simd_level level = detect_simd_level()) {
+    build(linear_bvh(list, opts), level);
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    if (nodes.empty())
+      return false;
+
+    auto wr = make_wide_ray(r.origin(), r.direction());
+
+    struct stack_entry {
+      int32_t index;
+      uint16_t count;
+      float tnear;
+    };
+
+    stack_entry stack[stack_size];
+    int stack_top = 0;
+    stack[stack_top++] = { 0, 0, -std::numeric_limits<float>::infinity() };
+
+    bool hit_anything = false;
+    alignas(32) float tnear[N];
+
+    while (stack_top > 0) {
+      auto entry = stack[--stack_top];
+      if (entry.tnear > ray_t.max) // 比当前最近交点还远
+        continue;
+
+      if (entry.count > 0) {
+        for (int i = 0; i < entry.count; ++i) {
+          if (primitives[entry.index + i]->hit(r, ray_t, rec)) {
+            hit_anything = true;
+            ray_t.max = rec.t;
+          }
+        }
+        continue;
+      }
+
+      const auto& node = nodes[entry.index];
+      int mask = intersect_children(node, wr, static_cast<float>(ray_t.min), static_cast<float>(ray_t.max), tnear);
+
+      // 命中的孩子按距离从远到近压栈，这样最近的孩子最先出栈
+      int first = stack_top;
+      while (mask) {
+        int i = lowest_bit(mask);
+        mask &= mask - 1;
+        stack_entry child = { node.child[i], node.count[i], tnear[i] };
+        int k = stack_top++;
+        while (k > first && stack[k - 1].tnear < child.tnear) {
+          stack[k] = stack[k - 1];
+          --k;
+        }
+        stack[k] = child;
+      }
+    }
+
+    return hit_anything;
+  }
+
+  // 整包遍历：对节点的每个孩子，一次 SIMD 运算测试 8 条(AVX2)或 4 条(SSE)光线，
+  // 光线掩码之外的光线不参与。孩子带着命中它的光线掩码和这些光线中最小的 tnear 入栈，
+  // 出栈时最近交点已经比它近的光线不再参与；叶子中的物体只对掩码内的光线求交
+  void hit_packet(ray_packet& packet, hit_record* rec) const override {
+    if (nodes.empty() || packet.active == 0)
+      return;
+
+    const uint32_t active = packet.active;
+    wide_packet rays;
+    rays.load(packet);
+
+    struct packet_entry {
+      int32_t index;
+      uint16_t count;
+      uint32_t rays;
+      float tnear;
+    };
+
+    packet_entry stack[stack_size];
+    int stack_top = 0;
+    stack[stack_top++] = { 0, 0, active, -std::numeric_limits<float>::infinity() };
+
+    alignas(32) float tnear[ray_packet::max_size];
+
+    while (stack_top > 0) {
+      auto entry = stack[--stack_top];
+      uint32_t mask = 0;
+      for (uint32_t m = entry.rays; m; m &= m - 1) {
+        int i = lowest_set_bit(m);
+        if (entry.tnear <= packet.tmax[i])
+          mask |= 1u << i;
+      }
+      if (!mask)
+        continue;
+
+      if (entry.count > 0) {
+        packet.active = mask;
+        for (int i = 0; i < entry.count; ++i)
+          primitives[entry.index + i]->hit_packet(packet, rec);
+        packet.active = active;
+        rays.update(packet, mask);
+        continue;
+      }
+
+      // 和 hit 相同，命中的孩子按距离从远到近压栈
+      const auto& node = nodes[entry.index];
+      int first = stack_top;
+      for (int c = 0; c < N; ++c) {
+        if (node.child[c] < 0)
+          continue;
+        uint32_t hits = intersect_child_packet(node, c, rays, packet.size, tnear) & mask;
+        if (!hits)
+          continue;
+
+        float child_near = std::numeric_limits<float>::infinity();
+        for (uint32_t m = hits; m; m &= m - 1) {
+          int i = lowest_set_bit(m);
+          child_near = fmin(child_near, tnear[i]);
+        }
+
+        packet_entry child = { node.child[c], node.count[c], hits, child_near };
+        int k = stack_top++;
+        while (k > first && stack[k - 1].tnear < child.tnear) {
+          stack[k] = stack[k - 1];
+          --k;
+        }
+        stack[k] = child;
+      }
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    for (const auto& object : primitives)
+      object->gather_lights(lights);
+  }
+
+  bool stochastic_hit() const override {
+    for (const auto& object : primitives)
+      if (object->stochastic_hit())
+        return true;
+    return false;
+  }
+
+  // 和 linear_bvh::refit 相同：结构不变，倒序扫描节点重算每个孩子的包围盒。
+  // 先在双精度下求出所有包围盒，再按新的场景范围确定 pad、取整写回单精度
+  void refit() override {
+    if (nodes.empty())
+      return;
+
+    for (auto& object : primitives)
+      object->refit();
+
+    std::vector<build_bounds> slot_box(nodes.size() * N);
+    std::vector<build_bounds> node_box(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0;) {
+      const auto& node = nodes[i];
+      node_box[i] = build_bounds::empty();
+      for (int k = 0; k < N; ++k) {
+        auto& b = slot_box[i * N + k];
+        b = build_bounds::empty();
+        if (node.child[k] < 0)
+          continue;
+        if (node.count[k] > 0) {
+          for (int p = 0; p < node.count[k]; ++p)
+            b.grow(primitives[node.child[k] + p]->bounding_box());
+        }
+        else {
+          b = node_box[node.child[k]];
+        }
+        node_box[i].grow(b);
+      }
+    }
+
+    const auto& root = node_box[0];
+    bbox = aabb(point3(root.lo[0], root.lo[1], root.lo[2]), point3(root.hi[0], root.hi[1], root.hi[2]));
+    pad = pad_for(bbox);
+
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      for (int k = 0; k < N; ++k) {
+        if (nodes[i].child[k] < 0)
+          continue;
+        const auto& b = slot_box[i * N + k];
+        for (int a = 0; a < 3; ++a) {
+          nodes[i].bmin[a][k] = round_down(b.lo[a] - pad);
+          nodes[i].bmax[a][k] = round_up(b.hi[a] + pad);
+        }
+      }
+    }
+  }
+
+  // 树的 SAH 代价(定义同 linear_bvh::sah_cost)，按孩子的包围盒计算，N 叉节点只算一次遍历
+  double sah_cost(double traversal_cost = bvh_options().traversal_cost) const {
+    if (nodes.empty())
+      return 0;
+
+    auto root_area = bbox.surface_area();
+    if (root_area <= 0)
+      return 0;
+
+    double cost = traversal_cost * root_area;
+    for (const auto& node : nodes) {
+      for (int k = 0; k < N; ++k) {
+        if (node.child[k] < 0)
+          continue;
+        double dx = node.bmax[0][k] - node.bmin[0][k];
+        double dy = node.bmax[1][k] - node.bmin[1][k];
+        double dz = node.bmax[2][k] - node.bmin[2][k];
+        auto area = 2 * (dx * dy + dy * dz + dz * dx);
+        cost += area * (node.count[k] > 0 ? node.count[k] : traversal_cost);
+      }
+    }
+    return cost / root_area;
+  }
+
+  size_t node_count() const { return nodes.size(); }
+
+  simd_level kernel_level() const { return level; }
+
+  // 节点 index 的第 slot 个孩子的(单精度、已扩张的)包围盒，没有孩子时返回 false
+  bool child_bounds(size_t index, int slot, aabb& box) const {
+    const auto& node = nodes[index];
+    if (node.child[slot] < 0)
+      return false;
+    box = aabb(point3(node.bmin[0][slot], node.bmin[1][slot], node.bmin[2][slot]),
+               point3(node.bmax[0][slot], node.bmax[1][slot], node.bmax[2][slot]));
+    return true;
+  }
+
+  // 用构造时选定的内核测试节点 index 的所有孩子，返回命中掩码。用来对照 SIMD 内核和标量内核
+  int child_mask(size_t index, const ray& r, interval ray_t) const {
+    alignas(32) float tnear[N];
+    return intersect_children(nodes[index], make_wide_ray(r.origin(), r.direction()),
+                              static_cast<float>(ray_t.min), static_cast<float>(ray_t.max), tnear);
+  }
+
+private:
+  // 二叉树最大深度约 128，每层最多压入 N-1 个兄弟
+  static const int stack_size = 128 * N;
+
+  std::vector<wide_bvh_node<N>> nodes;
+  std::vector<shared_ptr<hittable>> primitives;
+  aabb bbox;
+  simd_level level = simd_level::scalar;
+  double pad = 0; // 单精度包围盒向外扩张的距离，覆盖光线原点转换成 float 的舍入误差
+
+  static wide_ray make_wide_ray(const point3& origin, const vec3& direction) {
+    wide_ray wr;
+    for (int a = 0; a < 3; ++a) {
+      wr.org[a] = static_cast<float>(origin[a]);
+      wr.inv_dir[a] = static_cast<float>(1 / direction[a]);
+      wr.neg[a] = wr.inv_dir[a] < 0;
+    }
+    return wr;
+  }
+
+  static int lowest_bit(int mask) {
+    int i = 0;
+    while (!(mask & (1 << i))) ++i;
+    return i;
+  }
+
+  int intersect_children(const wide_bvh_node<N>& node, const wide_ray& r, float tmin, float tmax, float* tnear) const {
+#if RT_SIMD_X86
+    if (N == 8 && level == simd_level::avx2)
+      return intersect_avx2(node, r, tmin, tmax, tnear);
+    if (level != simd_level::scalar) {
+      int mask = 0;
+      for (int offset = 0; offset < N; offset += 4)
+        mask |= intersect_sse(node, offset, r, tmin, tmax, tnear) << offset;
+      return mask;
+    }
+#endif
+    return intersect_scalar(node, r, tmin, tmax, tnear);
+  }
+
+  // 孩子 c 和包内前 size 条光线的盒子测试，返回命中的光线掩码，tnear[i] 为光线 i 的进入距离
+  uint32_t intersect_child_packet(const wide_bvh_node<N>& node, int c, const wide_packet& p, int size, float* tnear) const {
+#if RT_SIMD_X86
+    if (level == simd_level::avx2)
+      return intersect_packet_avx2(node, c, p, size, tnear);
+    if (level == simd_level::sse)
+      return intersect_packet_sse(node, c, p, size, tnear);
+#endif
+    return intersect_packet_scalar(node, c, p, size, tnear);
+  }
+
+  static uint32_t intersect_packet_scalar(const wide_bvh_node<N>& node, int c, const wide_packet& p, int size, float* tnear) {
+    uint32_t mask = 0;
+    for (int i = 0; i < size; ++i) {
+      float t_near = p.tmin[i], t_far = p.tmax[i];
+      for (int a = 0; a < 3; ++a) {
+        bool neg = p.inv_dir[a][i] < 0;
+        float lo = neg ? node.bmax[a][c] : node.bmin[a][c];
+        float hi = neg ? node.bmin[a][c] : node.bmax[a][c];
+        float t0 = (lo - p.org[a][i]) * p.inv_dir[a][i];
+        float t1 = (hi - p.org[a][i]) * p.inv_dir[a][i];
+        t_near = t0 > t_near ? t0 : t_near;
+        t_far = t1 < t_far ? t1 : t_far;
+      }
+      tnear[i] = t_near;
+      if (t_near <= t_far) mask |= 1u << i;
+    }
+    return mask;
+  }
+
+  static int intersect_scalar(const wide_bvh_node<N>& node, const wide_ray& r, float tmin, float tmax, float* tnear) {
+    int mask = 0;
+    for (int i = 0; i < N; ++i) {
+      float t_near = tmin, t_far = tmax;
+      for (int a = 0; a < 3; ++a) {
+        float lo = r.neg[a] ? node.bmax[a][i] : node.bmin[a][i];
+        float hi = r.neg[a] ? node.bmin[a][i] : node.bmax[a][i];
+        float t0 = (lo - r.org[a]) * r.inv_dir[a];
+        float t1 = (hi - r.org[a]) * r.inv_dir[a];
+        t_near = t0 > t_near ? t0 : t_near;
+        t_far = t1 < t_far ? t1 : t_far;
+      }
+      tnear[i] = t_near;
+      if (t_near <= t_far) mask |= 1 << i;
+    }
+    return mask;
+  }
+
+#if RT_SIMD_X86
+  // 一次测试从 offset 开始的 4 个孩子
+  static int intersect_sse(const wide_bvh_node<N>& node, int offset, const wide_ray& r, float tmin, float tmax, float* tnear) {
+    __m128 t_near = _mm_set1_ps(tmin);
+    __m128 t_far = _mm_set1_ps(tmax);
+    for (int a = 0; a < 3; ++a) {
+      const float* lo = (r.neg[a] ? node.bmax[a] : node.bmin[a]) + offset;
+      const float* hi = (r.neg[a] ? node.bmin[a] : node.bmax[a]) + offset;
+      __m128 o = _mm_set1_ps(r.org[a]);
+      __m128 inv = _mm_set1_ps(r.inv_dir[a]);
+      __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(lo), o), inv);
+      __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(hi), o), inv);
+      // 原点在 slab 平面上且方向分量为 0 时 t0/t1 为 NaN(0 x inf)。max/min 指令遇到 NaN 返回第二个操作数，
+      // 所以 t0/t1 放在前面：NaN 不收紧区间，和标量内核的比较写法结果相同
+      t_near = _mm_max_ps(t0, t_near);
+      t_far = _mm_min_ps(t1, t_far);
+    }
+    _mm_storeu_ps(tnear + offset, t_near);
+    return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+  }
+
+  // 包内光线方向的符号各不相同，按每条光线 inv_dir 的符号选近平面和远平面
+  static uint32_t intersect_packet_sse(const wide_bvh_node<N>& node, int c, const wide_packet& p, int size, float* tnear) {
+    uint32_t mask = 0;
+    const __m128 zero = _mm_setzero_ps();
+    for (int g = 0; g < size; g += 4) {
+      __m128 t_near = _mm_load_ps(p.tmin + g);
+      __m128 t_far = _mm_load_ps(p.tmax + g);
+      for (int a = 0; a < 3; ++a) {
+        __m128 inv = _mm_load_ps(p.inv_dir[a] + g);
+        __m128 o = _mm_load_ps(p.org[a] + g);
+        __m128 neg = _mm_cmplt_ps(inv, zero);
+        __m128 bmin = _mm_set1_ps(node.bmin[a][c]);
+        __m128 bmax = _mm_set1_ps(node.bmax[a][c]);
+        __m128 lo = _mm_or_ps(_mm_and_ps(neg, bmax), _mm_andnot_ps(neg, bmin));
+        __m128 hi = _mm_or_ps(_mm_and_ps(neg, bmin), _mm_andnot_ps(neg, bmax));
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, o), inv);
+        t_near = _mm_max_ps(t0, t_near); // 操作数顺序见 intersect_sse
+        t_far = _mm_min_ps(t1, t_far);
+      }
+      _mm_store_ps(tnear + g, t_near);
+      mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) << g;
+    }
+    return mask;
+  }
+
+  RT_TARGET_AVX2
+  static uint32_t intersect_packet_avx2(const wide_bvh_node<N>& node, int c, const wide_packet& p, int size, float* tnear) {
+    uint32_t mask = 0;
+    for (int g = 0; g < size; g += 8) {
+      __m256 t_near = _mm256_load_ps(p.tmin + g);
+      __m256 t_far = _mm256_load_ps(p.tmax + g);
+      for (int a = 0; a < 3; ++a) {
+        __m256 inv = _mm256_load_ps(p.inv_dir[a] + g);
+        __m256 o = _mm256_load_ps(p.org[a] + g);
+        __m256 bmin = _mm256_set1_ps(node.bmin[a][c]);
+        __m256 bmax = _mm256_set1_ps(node.bmax[a][c]);
+        // blendv 按 inv 的符号位选择。inv 不会是 0 或 NaN，符号位为 1 正好是 inv < 0
+        __m256 lo = _mm256_blendv_ps(bmin, bmax, inv);
+        __m256 hi = _mm256_blendv_ps(bmax, bmin, inv);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(lo, o), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(hi, o), inv);
+        t_near = _mm256_max_ps(t0, t_near);
+        t_far = _mm256_min_ps(t1, t_far);
+      }
+      _mm256_store_ps(tnear + g, t_near);
+      mask |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ))) << g;
+    }
+    return mask;
+  }
+
+  RT_TARGET_AVX2
+  static int intersect_avx2(const wide_bvh_node<N>& node, const wide_ray& r, float tmin, float tmax, float* tnear) {
+    __m256 t_near = _mm256_set1_ps(tmin);
+    __m256 t_far = _mm256_set1_ps(tmax);
+    for (int a = 0; a < 3; ++a) {
+      const float* lo = r.neg[a] ? node.bmax[a] : node.bmin[a];
+      const float* hi = r.neg[a] ? node.bmin[a] : node.bmax[a];
+      __m256 o = _mm256_set1_ps(r.org[a]);
+      __m256 inv = _mm256_set1_ps(r.inv_dir[a]);
+      __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(lo), o), inv);
+      __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(hi), o), inv);
+      t_near = _mm256_max_ps(t0, t_near); // 操作数顺序见 intersect_sse
+      t_far = _mm256_min_ps(t1, t_far);
+    }
+    _mm256_storeu_ps(tnear, t_near);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+  }
+#endif
+
+  static double pad_for(const aabb& box) {
+    double extent = 1;
+    for (int a = 0; a < 3; ++a)
+      extent = fmax(extent, fmax(fabs(box.axis(a).min), fabs(box.axis(a).max)));
+    return extent * (1.0 / (1 << 18));
+  }
+
+  static float round_down(double d) {
+    auto f = static_cast<float>(d);
+    return (f > d) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+  }
+
+  static float round_up(double d) {
+    auto f = static_cast<float>(d);
+    return (f < d) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+  }
+
+  void build(const linear_bvh& binary, simd_level requested) {
+    level = requested;
+    if (N == 8 && level == simd_level::avx2 && !cpu_supports_avx2())
+      level = simd_level::sse;
+    if (!RT_SIMD_X86)
+      level = simd_level::scalar;
+
+    const auto& bnodes = binary.flat_nodes();
+    if (bnodes.empty())
+      return;
+
+    primitives = binary.ordered_primitives();
+    bbox = binary.bounding_box();
+
+    pad = pad_for(bbox);
+
+    nodes.reserve(bnodes.size() / 2 + 1);
+    if (bnodes[0].count > 0) {
+      // 整棵树只有一个叶子
+      nodes.emplace_back();
+      clear_node(nodes[0]);
+      set_child(nodes[0], 0, bnodes[0]);
+    }
+    else {
+      collapse(bnodes, 0);
+    }
+  }
+
+  static void clear_node(wide_bvh_node<N>& node) {
+    for (int i = 0; i < N; ++i) {
+      for (int a = 0; a < 3; ++a) {
+        node.bmin[a][i] = std::numeric_limits<float>::infinity();
+        node.bmax[a][i] = -std::numeric_limits<float>::infinity();
+      }
+      node.child[i] = -1;
+      node.count[i] = 0;
+    }
+  }
+
+  void set_child(wide_bvh_node<N>& node, int slot, const linear_bvh_node& b) const {
+    for (int a = 0; a < 3; ++a) {
+      node.bmin[a][slot] = round_down(b.bmin[a] - pad);
+      node.bmax[a][slot] = round_up(b.bmax[a] + pad);
+    }
+    node.child[slot] = b.offset;
+    node.count[slot] = b.count;
+  }
+
+  static double node_area(const linear_bvh_node& b) {
+    auto dx = b.bmax[0] - b.bmin[0], dy = b.bmax[1] - b.bmin[1], dz = b.bmax[2] - b.bmin[2];
+    return dx * dy + dy * dz + dz * dx;
+  }
+
+  // 把二叉内部节点 index 折叠为一个 N 叉节点：反复展开面积最大的内部孩子，直到凑满 N 个孩子
+  int collapse(const std::vector<linear_bvh_node>& bnodes, int index) {
+    int children[N];
+    int n = 0;
+    children[n++] = index + 1;
+    children[n++] = bnodes[index].offset;
+
+    while (n < N) {
+      int best = -1;
+      double best_area = -1;
+      for (int i = 0; i < n; ++i) {
+        const auto& c = bnodes[children[i]];
+        if (c.count == 0 && node_area(c) > best_area) {
+          best = i;
+          best_area = node_area(c);
+        }
+      }
+      if (best < 0) break; // 全部是叶子
+
+      int expanded = children[best];
+      children[best] = expanded + 1;
+      children[n++] = bnodes[expanded].offset;
+    }
+
+    int wide_index = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    clear_node(nodes[wide_index]);
+
+    for (int i = 0; i < n; ++i) {
+      const auto& c = bnodes[children[i]];
+      set_child(nodes[wide_index], i, c);
+      if (c.count == 0) {
+        int sub = collapse(bnodes, children[i]); // 递归时 nodes 可能扩容，之后再按下标写回
+        nodes[wide_index].child[i] = sub;
+      }
+    }
+
+    return wide_index;
+  }
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif
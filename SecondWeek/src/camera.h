@@ -3,11 +3,22 @@
 
 #include "common.h"
 
+#include "checkpoint.h"
 #include "color.h"
+#include "compile.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "image_output.h"
 #include "material.h"
+#include "thread_pool.h"
+#include "tile_writer.h"
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
 
 class camera {
 public:
@@ -16,6 +27,7 @@ public:
   int    samples_per_pixel = 10;   // Count of random samples for each pixel
   int    max_depth = 10;   // Maximum number of ray bounces into scene
   color  background;               // Scene background color
+  std::string output_file = "image.ppm";  // Result image; .png, .hdr and .pfm select those formats, anything else is binary PPM
 
   double vfov = 90;              // Vertical view angle (field of view)
   point3 lookfrom = point3(0, 0, -1);  // Point camera is looking from
@@ -25,27 +37,119 @@ public:
   double defocus_angle = 0;  // Variation angle of rays through each pixel
   double focus_dist = 10;    // Distance from camera lookfrom point to plane of perfect focus
 
+  int    thread_count = 0;       // Render threads, 0 uses every hardware thread
+  int    tile_size = 32;         // Edge length of the square tiles handed to the threads
+  int    packet_size = 8;        // Camera rays traced together as a packet (4, 8 or 16), 1 disables packets
+  bool   recursive_integrator = false; // Use the original recursive ray_color instead of the path loop (A/B comparison)
+  int    rr_min_bounces = 3;     // Bounces always traced before Russian roulette may end a path
+  bool   sample_lights = true;   // Next-event estimation: sample emissive quads/spheres at diffuse bounces, combined with MIS
+  sampler_type sampler = sampler_type::sobol;  // Sequence behind pixel jitter, lens, time and the first random numbers of each bounce
+  bool   blue_noise = false;     // Share the sequence between pixels, shifted by an R2 dither, so neighbouring errors differ
+
+  bool   adaptive_sampling = false;  // Spend samples_per_pixel * pixel count where the noise is, instead of evenly
+  int    min_samples = 16;           // Samples every pixel gets before its error is checked
+  int    max_samples = 0;            // Cap on samples for one pixel, 0 means 4 * samples_per_pixel
+  double adaptive_threshold = 0.02;  // A pixel stops once the standard error of its mean luminance is below this fraction of it
+  std::string sample_count_file;     // If set, adaptive sampling writes a grayscale image of samples per pixel here
+
+  bool   progressive = false;        // Render the whole image pass_samples at a time, checkpointing between passes
+  int    pass_samples = 16;          // Samples per pixel added by each progressive pass
+  double checkpoint_seconds = 600;   // Minimum time between checkpoints; one is always written after the last pass
+  std::string checkpoint_file = "render.ckpt";  // Accumulated sums, sample counts and progress
+  std::string preview_file = "preview.ppm";     // Image written alongside every checkpoint
+  bool   resume = false;             // Continue from checkpoint_file when it holds an image of the same size and sampling settings
+
+  bool   stream_output = false;      // Write tiles to output_file (.ppm or .pfm) as they finish instead of keeping the whole image
+  int    stream_buffers = 0;         // Resident tile buffers rendering or waiting for disk, 0 means 4 per thread
+
+  // A hittable_list world is flattened into one bvh8 (motion_bvh when objects move) before rendering, see compile.h.
+  // This replaces wrapping the top-level list in bvh_node/linear_bvh yourself; accelerators inside the list are kept.
+  // The result is cached and reused while the list holds the same objects. Set false to render the world as given
+  bool   compile_world = true;
+
   void render(const hittable& world) {
+    // 直接交给 render 的 hittable_list 先编译，平铺的列表不会进入每条光线的求交
+    auto list = dynamic_cast<const hittable_list*>(&world);
+    if (compile_world && list)
+      render_world(*compiled.get(*list));
+    else
+      render_world(world);
+  }
+
+private:
+  void render_world(const hittable& world) {
     initialize();
 
-    std::ofstream out("image.ppm", std::ios::out | std::ios::binary);
-    out << "P6\n" << image_width << ' ' << image_height << "\n255\n";
-    for (int j = 0; j < image_height; ++j) {// The rows are written out from top to bottom
-      std::cerr << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-      for (int i = 0; i < image_width; ++i) { // The pixels are written out in rows with pixels left to right
-        color pixel_color(0, 0, 0);
-        for (int s = 0; s < samples_per_pixel; ++s) {
-          ray r = get_ray(i, j); // get_ray 时 生成随机时间的线
-          pixel_color += ray_color(r, max_depth, world);
-        }
-        write_color6(out, pixel_color, samples_per_pixel);
-      }
+    lights.clear();
+    if (sample_lights)
+      world.gather_lights(lights);
+
+    // 介质在求交时取随机数，必须先切到这条光线第一次弹射的序列，和逐条追踪一样；光线包做不到，改为逐条求交
+    packet_primary = packet_size > 1 && !world.stochastic_hit();
+    if (packet_size > 1 && !packet_primary)
+      std::clog << "Scene has participating media, tracing camera rays one at a time\n";
+
+    auto tiles = make_tiles(image_width, image_height, tile_size);
+    path_stats totals;
+
+    // 渐进式和自适应采样需要整幅图的累积量，只有普通渲染才能流式输出
+    if (stream_output && !progressive && !adaptive_sampling && tile_writer::supports(output_file)) {
+      render_streaming(world, tiles, totals);
+      report(totals);
+      return;
     }
-    out.close();
-    std::clog << "\rDone.                 \n";
+
+    framebuffer image(image_width, image_height);
+    {
+      thread_pool pool(thread_count);
+      if (progressive)
+        render_progressive(world, pool, tiles, image, totals);
+      else if (adaptive_sampling)
+        render_adaptive(world, pool, tiles, image, totals);
+      else
+        run_tiles(pool, tiles, "", totals, [&](const tile& t, path_stats& stats) {
+          render_tile(world, t, image, stats);
+        });
+    }
+
+    if (!write_image(image, output_file))
+      std::clog << "\rFailed to write " << output_file << '\n';
+    report(totals);
   }
 
-private:
+  // 一个 tile 中追踪的路径数和光线段数(每次场景求交算一段)，用来统计平均路径长度
+  struct path_stats {
+    uint64_t paths = 0;
+    uint64_t segments = 0;
+  };
+
+  // 自适应采样时每个像素的累积量：颜色之和，以及亮度的 Welford 均值和二阶中心矩
+  struct pixel_estimate {
+    color sum;
+    double mean = 0;
+    double m2 = 0;
+    int count = 0;
+    bool converged = false;
+
+    void add(const color& c) {
+      sum += c;
+      auto y = 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+      ++count;
+      auto delta = y - mean;
+      mean += delta / count;
+      m2 += delta * (y - mean);
+    }
+
+    // 亮度均值的标准误差
+    double standard_error() const {
+      if (count < 2)
+        return infinity;
+      return sqrt(m2 / (count - 1) / count);
+    }
+  };
+
+  std::vector<const hittable*> lights;  // 光源采样使用的发光图元
+
   int    image_height;    // Rendered image height
   point3 center;          // Camera center
   point3 pixel00_loc;     // Location of pixel 0, 0
@@ -54,6 +158,9 @@ private:
   vec3   u, v, w;         // Camera frame basis vectors
   vec3   defocus_disk_u;  // Defocus disk horizontal radius
   vec3   defocus_disk_v;  // Defocus disk vertical radius
+  pixel_sampler sequence; // 像素采样器(见 sampler.h)
+  bool   packet_primary = false; // 相机光线按光线包求交(packet_size > 1 且场景求交不取随机数)
+  compiled_scene_cache compiled; // 上一次 render 编译的场景，同一个场景再次渲染时重用
 
   void initialize() {
     image_height = static_cast<int>(image_width / aspect_ratio);
@@ -88,27 +195,34 @@ private:
     auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
     defocus_disk_u = u * defocus_radius;
     defocus_disk_v = v * defocus_radius;
+
+    sequence = pixel_sampler(sampler, samples_per_pixel, blue_noise,
+                             camera_dimensions + bounce_dimensions * static_cast<uint32_t>(std::max(0, max_depth)));
   }
 
   ray get_ray(int i, int j) const {
     // Get a randomly-sampled camera ray for the pixel at location i,j, originating from
     // the camera defocus disk.
 
+    // 按采样器的维度顺序取数：像素内位置、镜头、时间。没有景深时也取镜头的两维，时间总在第 5 维
+    auto px = random_double();
+    auto py = random_double();
+    auto lens_u = random_double();
+    auto lens_v = random_double();
+    auto ray_time = random_double();
+
     auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
-    auto pixel_sample = pixel_center + pixel_sample_square();
+    auto pixel_sample = pixel_center + pixel_sample_square(px, py);
 
-    auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+    auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample(lens_u, lens_v);
     auto ray_direction = pixel_sample - ray_origin;
-    auto ray_time = random_double();
 
     return ray(ray_origin, ray_direction, ray_time);
   }
 
-  vec3 pixel_sample_square() const {
-    // Returns a random point in the square surrounding a pixel at the origin.
-    auto px = -0.5 + random_double();
-    auto py = -0.5 + random_double();
-    return (px * pixel_delta_u) + (py * pixel_delta_v);
+  vec3 pixel_sample_square(double px, double py) const {
+    // Returns the point in the square surrounding a pixel at the origin for a sample in the unit square.
+    return ((px - 0.5) * pixel_delta_u) + ((py - 0.5) * pixel_delta_v);
   }
 
   vec3 pixel_sample_disk(double radius) const {
@@ -117,18 +231,466 @@ private:
     return (p[0] * pixel_delta_u) + (p[1] * pixel_delta_v);
   }
 
-  point3 defocus_disk_sample() const {
-    // Returns a random point in the camera defocus disk.
-    auto p = random_in_unit_disk();
+  point3 defocus_disk_sample(double u1, double u2) const {
+    // Returns a point in the camera defocus disk for a sample in the unit square.
+    auto p = square_to_disk(u1, u2);
     return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
   }
 
+  // 图像分块后交给工作窃取线程池，每个 tile 调用一次 func(tile, path_stats&)；label 非空时显示在进度前面
+  template <typename TileFunc>
+  void run_tiles(thread_pool& pool, const std::vector<tile>& tiles, const std::string& label,
+                 path_stats& totals, TileFunc func) const {
+    std::atomic<int> tiles_remaining(static_cast<int>(tiles.size()));
+    std::atomic<uint64_t> total_paths(0), total_segments(0);
+    std::mutex progress_mutex;
+
+    task_group group(pool);
+    for (const auto& t : tiles) {
+      group.run([&, t] {
+        path_stats stats;
+        func(t, stats);
+        pixel_sampler::finish();
+        total_paths += stats.paths;
+        total_segments += stats.segments;
+
+        int remaining = --tiles_remaining;
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        std::clog << "\r" << label << "Tiles remaining: " << remaining << ' ' << std::flush;
+      });
+    }
+    group.wait();
+
+    totals.paths += total_paths;
+    totals.segments += total_segments;
+  }
+
+  void report(const path_stats& totals) const {
+    std::clog << "\rDone.                 \n";
+    if (totals.paths > 0)
+      std::clog << "Average path length: " << static_cast<double>(totals.segments) / totals.paths << " rays\n";
+  }
+
+  // 流式输出：每个 tile 渲染进 tile_writer 的小缓冲，交给后台线程写盘
+  void render_streaming(const hittable& world, const std::vector<tile>& tiles, path_stats& totals) const {
+    thread_pool pool(thread_count);
+    size_t buffers = stream_buffers > 0 ? stream_buffers : 4 * static_cast<size_t>(pool.size());
+    tile_writer writer(output_file, image_width, image_height, buffers);
+
+    run_tiles(pool, tiles, "", totals, [&](const tile& t, path_stats& stats) {
+      auto buffer = writer.acquire(t);
+      render_tile(world, t, *buffer, stats);
+      writer.submit(buffer);
+    });
+
+    if (!writer.finish())
+      std::clog << "\rFailed to write " << output_file << '\n';
+    if (writer.overflow_count() > 0)
+      std::clog << "Tile writer fell behind: " << writer.overflow_count() << " tiles needed an extra buffer beyond "
+        << buffers << '\n';
+  }
+
+  // 检查点中决定样本序列和估计方式的设置，任何一项不同，继续渲染都会混合两种不同的样本
+  void record_sequence(render_checkpoint& state) const {
+    state.samples_per_pixel = samples_per_pixel;
+    state.sampler = static_cast<int>(sampler);
+    state.blue_noise = blue_noise;
+    state.max_depth = max_depth;
+    state.rr_min_bounces = rr_min_bounces;
+    state.sample_lights = sample_lights;
+  }
+
+  bool same_sequence(const render_checkpoint& state) const {
+    render_checkpoint current;
+    record_sequence(current);
+    return state.samples_per_pixel == current.samples_per_pixel && state.sampler == current.sampler
+      && state.blue_noise == current.blue_noise && state.max_depth == current.max_depth
+      && state.rr_min_bounces == current.rr_min_bounces && state.sample_lights == current.sample_lights;
+  }
+
+  // 渐进式渲染：每一轮给整幅图的每个像素追加 pass_samples 个样本，累加到 double 缓冲中；
+  // 距上次检查点超过 checkpoint_seconds 时保存检查点和预览图。像素的第 s 个样本总是按相同顺序累加，
+  // 所以中断后继续渲染的结果和一次渲染完成的结果逐位相同
+  void render_progressive(const hittable& world, thread_pool& pool, const std::vector<tile>& tiles,
+                          framebuffer& image, path_stats& totals) const {
+    render_checkpoint state;
+    bool loaded = resume && state.load(checkpoint_file);
+    if (loaded && state.width == image_width && state.height == image_height
+        && state.samples_done <= samples_per_pixel && same_sequence(state)) {
+      std::clog << "Resuming from " << checkpoint_file << " at " << state.samples_done << " samples per pixel\n";
+    }
+    else {
+      if (loaded)
+        std::clog << "Checkpoint " << checkpoint_file << " was rendered with a different size, sample count, "
+          << "sampler or depth, starting from scratch\n";
+      else if (resume)
+        std::clog << "No usable checkpoint in " << checkpoint_file << ", starting from scratch\n";
+      state.reset(image_width, image_height);
+      record_sequence(state);
+    }
+
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    while (state.samples_done < samples_per_pixel) {
+      int first = state.samples_done;
+      int last = std::min(samples_per_pixel, first + std::max(1, pass_samples));
+
+      auto label = "Samples " + std::to_string(last) + "/" + std::to_string(samples_per_pixel) + ", ";
+      run_tiles(pool, tiles, label, totals, [&](const tile& t, path_stats& stats) {
+        for (int j = t.y0; j < t.y1; ++j) {
+          for (int i = t.x0; i < t.x1; ++i) {
+            auto index = static_cast<size_t>(j) * image_width + i;
+            auto sum = &state.sums[3 * index];
+            color pixel_color(sum[0], sum[1], sum[2]);
+            for (int s = first; s < last; ++s)
+              pixel_color += sample_pixel(i, j, s, world, stats);
+            sum[0] = pixel_color.x();
+            sum[1] = pixel_color.y();
+            sum[2] = pixel_color.z();
+            state.counts[index] += last - first;
+          }
+        }
+      });
+      state.samples_done = last;
+
+      auto now = std::chrono::steady_clock::now();
+      bool finished = last >= samples_per_pixel;
+      if (finished || std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_seconds) {
+        resolve(state, image);
+        if (!state.save(checkpoint_file))
+          std::clog << "\nFailed to write checkpoint " << checkpoint_file << '\n';
+        write_image(image, preview_file);
+        last_checkpoint = now;
+      }
+    }
+
+    resolve(state, image);
+  }
+
+  // 累加和除以样本数得到像素颜色
+  void resolve(const render_checkpoint& state, framebuffer& image) const {
+    for (int j = 0; j < image_height; ++j) {
+      for (int i = 0; i < image_width; ++i) {
+        auto index = static_cast<size_t>(j) * image_width + i;
+        auto sum = &state.sums[3 * index];
+        auto n = state.counts[index] > 0 ? state.counts[index] : 1;
+        image.set(i, j, color(sum[0], sum[1], sum[2]) / n);
+      }
+    }
+  }
+
+  // 自适应采样：先给每个像素 min_samples 个样本，之后每一轮只给误差还没达标的像素追加样本。
+  // 总预算仍是 samples_per_pixel * 像素数，收敛像素省下的样本平均分给剩下的像素(单个像素不超过 max_samples)，
+  // 每轮追加的数量最多翻倍，以便及时重新检查误差。每轮的决定只取决于上一轮的结果，线程数不影响图像
+  void render_adaptive(const hittable& world, thread_pool& pool, const std::vector<tile>& tiles,
+                       framebuffer& image, path_stats& totals) const {
+    size_t pixel_count = static_cast<size_t>(image_width) * image_height;
+    std::vector<pixel_estimate> pixels(pixel_count);
+
+    int max_spp = max_samples > 0 ? max_samples : 4 * samples_per_pixel;
+    int min_spp = std::max(2, std::min(min_samples, max_spp));
+    uint64_t budget = static_cast<uint64_t>(samples_per_pixel) * pixel_count;
+    uint64_t batch = min_spp;
+    int pass = 0;
+
+    while (true) {
+      ++pass;
+      auto pass_samples = static_cast<int>(batch);
+      run_tiles(pool, tiles, "Pass " + std::to_string(pass) + ", ", totals, [&](const tile& t, path_stats& stats) {
+        for (int j = t.y0; j < t.y1; ++j) {
+          for (int i = t.x0; i < t.x1; ++i) {
+            auto& px = pixels[static_cast<size_t>(j) * image_width + i];
+            if (px.converged)
+              continue;
+            int n = std::min(pass_samples, max_spp - px.count);
+            for (int k = 0; k < n; ++k)
+              px.add(sample_pixel(i, j, px.count, world, stats));
+          }
+        }
+      });
+      update_convergence(pixels, max_spp);
+
+      uint64_t used = 0;
+      size_t active = 0;
+      for (const auto& px : pixels) {
+        used += px.count;
+        if (!px.converged) ++active;
+      }
+      if (active == 0 || used >= budget)
+        break;
+
+      batch = std::min((budget - used) / active, batch * 2);
+      if (batch == 0)
+        break;
+    }
+
+    uint64_t used = 0;
+    int fewest = max_spp, most = 0;
+    for (int j = 0; j < image_height; ++j) {
+      for (int i = 0; i < image_width; ++i) {
+        const auto& px = pixels[static_cast<size_t>(j) * image_width + i];
+        image.set(i, j, px.sum / px.count);
+        used += px.count;
+        fewest = std::min(fewest, px.count);
+        most = std::max(most, px.count);
+      }
+    }
+    std::clog << "\rAdaptive sampling: " << pass << " passes, "
+              << static_cast<double>(used) / pixel_count << " samples per pixel on average ("
+              << fewest << " - " << most << ")\n";
+
+    if (!sample_count_file.empty())
+      write_sample_counts(pixels, max_spp);
+  }
+
+  // 像素的误差取 3x3 邻域内最大的标准误差，和邻域的平均亮度比较；很暗的地方按亮度 0.01 计算，避免除以接近 0 的值。
+  // 只看单个像素时，难以采到光源的像素前几个样本可能全是 0，方差为 0 会被误判为已经收敛
+  void update_convergence(std::vector<pixel_estimate>& pixels, int max_spp) const {
+    std::vector<uint8_t> converged(pixels.size(), 0);
+    for (int j = 0; j < image_height; ++j) {
+      for (int i = 0; i < image_width; ++i) {
+        const auto& px = pixels[static_cast<size_t>(j) * image_width + i];
+        if (px.converged || px.count >= max_spp) {
+          converged[static_cast<size_t>(j) * image_width + i] = 1;
+          continue;
+        }
+
+        double error = 0, mean = 0;
+        int neighbors = 0;
+        for (int y = std::max(0, j - 1); y <= std::min(image_height - 1, j + 1); ++y) {
+          for (int x = std::max(0, i - 1); x <= std::min(image_width - 1, i + 1); ++x) {
+            const auto& n = pixels[static_cast<size_t>(y) * image_width + x];
+            error = fmax(error, n.standard_error());
+            mean += n.mean;
+            ++neighbors;
+          }
+        }
+        converged[static_cast<size_t>(j) * image_width + i] = error <= adaptive_threshold * fmax(mean / neighbors, 0.01);
+      }
+    }
+
+    for (size_t k = 0; k < pixels.size(); ++k)
+      pixels[k].converged = converged[k] != 0;
+  }
+
+  // 每个像素的样本数按 max_spp 归一化成灰度(不做 gamma)，越亮的地方样本越多
+  void write_sample_counts(const std::vector<pixel_estimate>& pixels, int max_spp) const {
+    framebuffer counts(image_width, image_height);
+    for (int j = 0; j < image_height; ++j) {
+      for (int i = 0; i < image_width; ++i) {
+        auto v = static_cast<double>(pixels[static_cast<size_t>(j) * image_width + i].count) / max_spp;
+        counts.set(i, j, color(v, v, v));
+      }
+    }
+    write_image(counts, sample_count_file, false);
+  }
+
+  // 像素 (i, j) 的第 s 个样本：随机序列只由像素和样本编号决定
+  void start_sample(int i, int j, int s) const {
+    sequence.start(i, j, static_cast<uint64_t>(j) * image_width + i, s);
+  }
+
+  color sample_pixel(int i, int j, int s, const hittable& world, path_stats& stats) const {
+    start_sample(i, j, s);
+    ray r = get_ray(i, j); // get_ray 时 生成随机时间的线
+    return ray_color(r, world, stats);
+  }
+
+  void render_tile(const hittable& world, const tile& t, framebuffer& image, path_stats& stats) const {
+    if (packet_primary) {
+      render_tile_packets(world, t, image, stats);
+      return;
+    }
+
+    for (int j = t.y0; j < t.y1; ++j) {
+      for (int i = t.x0; i < t.x1; ++i) {
+        color pixel_color(0, 0, 0);
+        for (int s = 0; s < samples_per_pixel; ++s)
+          pixel_color += sample_pixel(i, j, s, world, stats);
+        image.set(i, j, pixel_color / samples_per_pixel);
+      }
+    }
+  }
+
+  // 光线包覆盖的像素块：4 -> 2x2，8 -> 4x2，16 -> 4x4
+  void packet_shape(int& width, int& height) const {
+    if (packet_size >= 16) { width = 4; height = 4; }
+    else if (packet_size >= 8) { width = 4; height = 2; }
+    else { width = 2; height = 2; }
+  }
+
+  // 一次生成一个像素块中每个像素的第 s 个采样光线，按 SoA 写入光线包
+  void get_ray_packet(int i0, int j0, int width, int height, int s, ray_packet& packet) const {
+    packet.clear();
+    for (int dj = 0; dj < height; ++dj) {
+      for (int di = 0; di < width; ++di) {
+        int i = i0 + di, j = j0 + dj;
+        start_sample(i, j, s);
+        packet.set(packet.size++, get_ray(i, j), interval(0.001, infinity));
+      }
+    }
+  }
+
+  // 相机光线高度相干，第一次求交按光线包整体遍历；之后各条路径方向发散，改回逐条追踪
+  void render_tile_packets(const hittable& world, const tile& t, framebuffer& image, path_stats& stats) const {
+    int packet_w, packet_h;
+    packet_shape(packet_w, packet_h);
+
+    ray_packet packet;
+    hit_record rec[ray_packet::max_size];
+    color pixel_color[ray_packet::max_size];
+
+    for (int j0 = t.y0; j0 < t.y1; j0 += packet_h) {
+      for (int i0 = t.x0; i0 < t.x1; i0 += packet_w) {
+        int width = std::min(packet_w, t.x1 - i0);
+        int height = std::min(packet_h, t.y1 - j0);
+        int count = width * height;
+
+        for (int k = 0; k < count; ++k)
+          pixel_color[k] = color(0, 0, 0);
+
+        for (int s = 0; s < samples_per_pixel; ++s) {
+          get_ray_packet(i0, j0, width, height, s, packet);
+          world.hit_packet(packet, rec);
+
+          for (int k = 0; k < count; ++k) {
+            auto i = i0 + k % width, j = j0 + k / width;
+            start_sample(i, j, s);
+            if (max_depth <= 0)
+              continue;
+            rng_start_bounce(1);
+            ++stats.paths;
+            ++stats.segments;
+            if (!(packet.hit_mask & (1u << k)))
+              pixel_color[k] += background;
+            else if (recursive_integrator)
+              pixel_color[k] += shade(packet.get(k), rec[k], max_depth, world, stats);
+            else
+              pixel_color[k] += trace_path(packet.get(k), &rec[k], world, stats);
+          }
+        }
+
+        for (int k = 0; k < count; ++k)
+          image.set(i0 + k % width, j0 + k / width, pixel_color[k] / samples_per_pixel);
+      }
+    }
+  }
+
+  color ray_color(const ray& r, const hittable& world, path_stats& stats) const {
+    ++stats.paths;
+    if (recursive_integrator)
+      return ray_color(r, max_depth, world, stats);
+    return trace_path(r, nullptr, world, stats);
+  }
+
+  // 路径积分的循环版本：throughput 记录路径上各次衰减的乘积，每次弹射只需要一个 hit_record。
+  // 弹射 rr_min_bounces 次以后用俄罗斯轮盘赌结束贡献小的路径：以概率 q 继续并把 throughput 除以 q，期望不变。
+  // primary 不为空时是光线包已经求出的第一个交点
+  color trace_path(ray r, const hit_record* primary, const hittable& world, path_stats& stats) const {
+    color radiance(0, 0, 0);
+    color throughput(1, 1, 1);
+    hit_record rec;
+    bool specular_bounce = true; // 上一次散射没有做光源采样(相机光线也算)
+    double bsdf_pdf = 0;         // 上一次散射方向的概率密度
+
+    for (int bounce = 1; bounce <= max_depth; ++bounce) {
+      const hit_record* hit = primary;
+      if (bounce > 1 || !primary) {
+        rng_start_bounce(bounce); // 每次弹射使用独立的随机序列
+        ++stats.segments;
+        if (!world.hit(r, interval(0.001, infinity), rec)) {
+          radiance += throughput * background;
+          break;
+        }
+        hit = &rec;
+      }
+
+      // 光源采样也能得到这个发光点时，两种采样按 MIS 权重各算一部分
+      auto emitted = hit->mat_ptr->emitted(hit->u, hit->v, hit->p);
+      if (!specular_bounce && hit->mat_ptr->is_emissive())
+        emitted *= light_hit_weight(r, *hit, bsdf_pdf);
+      radiance += throughput * emitted;
+
+      // 路径最多 max_depth 段，和 ray_color 相同。最后一个交点不再做光源采样：
+      // 它配对的 BSDF 采样光线不会被追踪，只算光源采样那一半会让这些路径偏暗
+      if (bounce == max_depth)
+        break;
+
+      bsdf_sample bs;
+      if (!hit->mat_ptr->sample(r, *hit, bs)) // 自发光材质不散射光
+        break;
+
+      specular_bounce = lights.empty() || bs.specular;
+      if (!specular_bounce) {
+        radiance += throughput * sample_light(r, *hit, world);
+        bsdf_pdf = bs.pdf;
+      }
+
+      throughput = throughput * bs.weight;
+      if (bounce >= rr_min_bounces) {
+        auto q = fmin(0.95, fmax(throughput.x(), fmax(throughput.y(), throughput.z())));
+        if (random_double() >= q)
+          break;
+        throughput /= q;
+      }
+
+      r = ray(hit->p, bs.direction, r.time());
+    }
+
+    return radiance;
+  }
+
+  static double power_heuristic(double pdf_a, double pdf_b) {
+    return pdf_a * pdf_a / (pdf_a * pdf_a + pdf_b * pdf_b);
+  }
+
+  // 下一事件估计：随机选一个光源，在上面采样一点，向它发出阴影光线。
+  // 没被遮挡时返回 f * cos * Le / pdf_light，再乘上光源采样的 MIS 权重
+  color sample_light(const ray& r_in, const hit_record& rec, const hittable& world) const {
+    auto n = lights.size();
+    auto light = lights[std::min(static_cast<size_t>(random_double() * n), n - 1)];
+
+    ray to_light(rec.p, light->random(rec.p), r_in.time());
+    hit_record light_rec;
+    if (!light->hit(to_light, interval(0.001, infinity), light_rec))
+      return color(0, 0, 0);
+
+    auto light_pdf = light->pdf_value(to_light.origin(), to_light.direction()) / n;
+    auto bsdf_pdf = rec.mat_ptr->pdf(r_in, rec, to_light.direction());
+    if (light_pdf <= 0 || bsdf_pdf <= 0)
+      return color(0, 0, 0);
+
+    // 光源之前有任何交点就算被遮挡；穿过介质时介质随机产生的散射点同样会挡住，期望正好是透射率
+    hit_record blocker;
+    if (world.hit(to_light, interval(0.001, light_rec.t * (1 - 1e-6)), blocker))
+      return color(0, 0, 0);
+
+    auto emitted = light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p);
+    auto f = rec.mat_ptr->eval(r_in, rec, to_light.direction());
+    return f * emitted * (power_heuristic(light_pdf, bsdf_pdf) / light_pdf);
+  }
+
+  // BSDF 采样的光线击中发光点时的 MIS 权重：找出击中的是哪个光源(沿同一光线的交点距离相同)，
+  // 求光源采样得到这个方向的概率密度。不在光源列表里的发光物体只能由 BSDF 采样得到，权重为 1
+  double light_hit_weight(const ray& r, const hit_record& rec, double bsdf_pdf) const {
+    for (auto light : lights) {
+      hit_record light_rec;
+      if (light->hit(r, interval(0.001, infinity), light_rec) && fabs(light_rec.t - rec.t) <= 1e-9 * rec.t) {
+        auto light_pdf = light->pdf_value(r.origin(), r.direction()) / lights.size();
+        return power_heuristic(bsdf_pdf, light_pdf);
+      }
+    }
+    return 1;
+  }
+
   // 设置递归深度（光线反射次数）
-  color ray_color(const ray& r, int depth, const hittable& world) const {
+  color ray_color(const ray& r, int depth, const hittable& world, path_stats& stats) const {
     // If we've exceeded the ray bounce limit, no more light is gathered.
     if (depth <= 0)
       return color(0, 0, 0);
 
+    rng_start_bounce(max_depth - depth + 1); // 每次弹射使用独立的随机序列
+    ++stats.segments;
+
     hit_record rec;
 
     // If the ray hits nothing, return the background color.
@@ -140,16 +702,19 @@ private:
       return background;
     }
 
-    // 渲染击中物体
+    return shade(r, rec, depth, world, stats);
+  }
+
+  // 渲染击中物体：自发光加上散射光线带回的颜色
+  color shade(const ray& r, const hit_record& rec, int depth, const hittable& world, path_stats& stats) const {
     ray scattered;
     color attenuation;
     color color_from_emission = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
     if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) // 自发光材质不散射光
       return color_from_emission;
 
-    color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world);
+    color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world, stats);
     return color_from_emission + color_from_scatter;
-
   }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+﻿#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// 渐进式渲染的检查点：每个像素颜色的累加和(double)、样本数，以及已经完成的样本数。
+// 随机序列只由(像素, 样本, 弹射)决定，已完成的样本数就是全部的随机数状态，
+// 从检查点继续渲染得到的结果和一次渲染完全相同。文件按本机字节序保存。
+// 前提是决定样本序列和估计方式的设置也相同，这些设置一起写在文件头里，继续渲染前逐项比较
+struct render_checkpoint {
+  int width = 0;
+  int height = 0;
+  int samples_done = 0;
+  int samples_per_pixel = 0; // 采样器按它分层
+  int sampler = 0;           // sampler_type
+  int blue_noise = 0;
+  int max_depth = 0;
+  int rr_min_bounces = 0;
+  int sample_lights = 0;
+  std::vector<double> sums;     // 每个像素 rgb 三个分量
+  std::vector<uint32_t> counts; // 每个像素的样本数
+
+  void reset(int w, int h) {
+    width = w;
+    height = h;
+    samples_done = 0;
+    sums.assign(static_cast<size_t>(w) * h * 3, 0.0);
+    counts.assign(static_cast<size_t>(w) * h, 0);
+  }
+
+  // 先写入临时文件再改名，写到一半被杀掉时旧的检查点仍然完整
+  bool save(const std::string& path) const {
+    auto temp = path + ".tmp";
+    {
+      std::ofstream out(temp, std::ios::out | std::ios::binary);
+      if (!out)
+        return false;
+
+      int32_t header[header_size] = { version, width, height, samples_done, samples_per_pixel, sampler,
+                                      blue_noise, max_depth, rr_min_bounces, sample_lights };
+      out.write(magic, sizeof(magic));
+      out.write(reinterpret_cast<const char*>(header), sizeof(header));
+      out.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint32_t));
+      out.write(reinterpret_cast<const char*>(sums.data()), sums.size() * sizeof(double));
+      if (!out)
+        return false;
+    }
+
+    std::remove(path.c_str()); // Windows 上 rename 不会覆盖已有文件
+    return std::rename(temp.c_str(), path.c_str()) == 0;
+  }
+
+  bool load(const std::string& path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in)
+      return false;
+
+    char file_magic[sizeof(magic)];
+    int32_t header[header_size];
+    in.read(file_magic, sizeof(file_magic));
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!in || std::memcmp(file_magic, magic, sizeof(magic)) != 0 || header[0] != version)
+      return false;
+    if (header[1] <= 0 || header[2] <= 0 || header[3] < 0)
+      return false;
+
+    reset(header[1], header[2]);
+    samples_done = header[3];
+    samples_per_pixel = header[4];
+    sampler = header[5];
+    blue_noise = header[6];
+    max_depth = header[7];
+    rr_min_bounces = header[8];
+    sample_lights = header[9];
+    in.read(reinterpret_cast<char*>(counts.data()), counts.size() * sizeof(uint32_t));
+    in.read(reinterpret_cast<char*>(sums.data()), sums.size() * sizeof(double));
+    return static_cast<bool>(in);
+  }
+
+private:
+  static constexpr char magic[4] = { 'R', 'T', 'C', 'K' };
+  static const int32_t version = 2; // 版本 1 的文件头没有渲染设置，不能继续
+  static const int header_size = 10;
+};
+
+#endif
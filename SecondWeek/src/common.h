@@ -5,7 +5,9 @@
 #include <limits>
 #include <memory>
 #include <cstdlib> // rand() RAND_MAX
-#include <random>
+
+#include "rng.h"
+#include "sampler.h"
 
 // Usings
 
@@ -29,11 +31,19 @@ inline double random_double0() {
   // Returns a random real in [0,1).
   return rand() / (RAND_MAX + 1.0);
 }
-// 新版c++随机数生成
+// 线程各自的 PCG32 随机数生成(见 rng.h)；渲染时每次弹射的前几个随机数取自像素采样器(见 sampler.h)
 inline double random_double() {
-  static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-  static std::mt19937 generator;
-  return distribution(generator);
+  // Returns a random real in [0,1).
+  auto& ctx = thread_rng();
+  if (ctx.dimension < ctx.dimension_end)
+    return ctx.sampler->get(ctx, ctx.dimension++);
+  return ctx.generator.next_double();
+}
+
+// 只取自本次弹射的 PCG32 流，不占用采样器维度。用量不定的循环(介质中的 delta tracking)用它，
+// 否则会把同一次弹射里材质采样、光源采样的分层维度挤掉
+inline double random_stream_double() {
+  return thread_rng().generator.next_double();
 }
 
 inline double random_double(double min, double max) {
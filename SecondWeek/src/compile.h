@@ -0,0 +1,167 @@
+﻿#ifndef COMPILE_H
+#define COMPILE_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "bvh_motion.h"
+#include "bvh_wide.h"
+#include "hittable_list.h"
+#include "instance.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// 场景编译：渲染前把场景整理成一棵加速结构。
+// 嵌套的 hittable_list 展开成一层；translate/rotate_y 的嵌套合并成一个 instance(一次矩阵变换)，
+// 被包装的如果是列表，先单独编译成一棵 BVH 再实例化；最后在所有图元上建一棵 bvh8。
+// 有图元在移动(motion_bounds 两端不同，比如移动的球)时改建 motion_bvh：节点包围盒随光线时间插值，
+// 不用覆盖整条轨迹的包围盒，移动快时还按时间划分(bvh_options::interpolate_motion 为 false 时仍建 bvh8)。
+// 已经是加速结构的物体(bvh8、grid_accel 等)当作一个图元原样保留，场景作者选定的结构不会被替换
+class scene_compiler {
+public:
+  explicit scene_compiler(const bvh_options& opts = bvh_options()) : opts(opts) {}
+
+  shared_ptr<hittable> compile(const hittable_list& world) {
+    auto start = std::chrono::steady_clock::now();
+    lists = wrappers = moving = 0;
+
+    std::vector<shared_ptr<hittable>> primitives;
+    for (const auto& object : world.objects)
+      flatten(object, primitives);
+    for (const auto& object : primitives)
+      if (is_moving(*object))
+        ++moving;
+    bool motion = opts.interpolate_motion && moving > 0 && primitives.size() > 1;
+    auto result = accelerate(primitives, opts);
+
+    if (opts.report)
+      std::clog << "compile_scene: " << world.objects.size() << " top-level objects -> " << primitives.size()
+        << " primitives (" << lists << " nested lists flattened, " << wrappers << " transforms collapsed, "
+        << moving << " moving) -> " << (motion ? "motion_bvh" : "bvh8") << ", "
+        << elapsed_ms(start) << " ms\n";
+    return result;
+  }
+
+private:
+  bvh_options opts;
+  int lists = 0;
+  int wrappers = 0;
+  int moving = 0;
+
+  static bool is_moving(const hittable& object) {
+    aabb start, end;
+    object.motion_bounds(start, end);
+    for (int a = 0; a < 3; ++a)
+      if (start.axis(a).min != end.axis(a).min || start.axis(a).max != end.axis(a).max)
+        return true;
+    return false;
+  }
+
+  void flatten(const shared_ptr<hittable>& object, std::vector<shared_ptr<hittable>>& out) {
+    if (auto list = dynamic_cast<const hittable_list*>(object.get())) {
+      ++lists;
+      for (const auto& child : list->objects)
+        flatten(child, out);
+      return;
+    }
+
+    // translate(rotate_y(translate(...)))：外层的变换乘在左边
+    transform xf;
+    auto inner = object;
+    for (;;) {
+      if (auto t = dynamic_cast<const translate*>(inner.get())) {
+        xf = xf * t->object_to_world();
+        inner = t->wrapped();
+      }
+      else if (auto r = dynamic_cast<const rotate_y*>(inner.get())) {
+        xf = xf * r->object_to_world();
+        inner = r->wrapped();
+      }
+      else
+        break;
+      ++wrappers;
+    }
+
+    if (inner == object) {
+      out.push_back(object);
+      return;
+    }
+
+    if (auto list = dynamic_cast<const hittable_list*>(inner.get())) {
+      ++lists;
+      std::vector<shared_ptr<hittable>> parts;
+      for (const auto& child : list->objects)
+        flatten(child, parts);
+      auto inner_opts = opts;
+      inner_opts.report = false;
+      inner = accelerate(parts, inner_opts);
+    }
+    out.push_back(make_shared<instance>(inner, xf));
+  }
+
+  static shared_ptr<hittable> accelerate(const std::vector<shared_ptr<hittable>>& primitives, const bvh_options& opts) {
+    if (primitives.size() == 1)
+      return primitives[0];
+
+    hittable_list list;
+    for (const auto& object : primitives)
+      list.add(object);
+    if (primitives.empty())
+      return make_shared<hittable_list>(list);
+    if (opts.interpolate_motion)
+      for (const auto& object : primitives)
+        if (is_moving(*object))
+          return make_shared<motion_bvh>(list, opts);
+    return make_shared<bvh8>(list, opts);
+  }
+};
+
+inline shared_ptr<hittable> compile_scene(const hittable_list& world, const bvh_options& opts = bvh_options()) {
+  return scene_compiler(opts).compile(world);
+}
+
+// 编译结果的缓存：列表里还是同样的物体(同一组指针，包围盒也没变)时直接返回上次的结果，
+// camera 用它避免每次 render 都重新展开列表、重建 BVH。保存物体的 shared_ptr，旧物体的地址不会被新物体重用。
+// 只比较顶层物体：嵌套列表里的物体原地移动后要先 clear
+class compiled_scene_cache {
+public:
+  const shared_ptr<hittable>& get(const hittable_list& world, const bvh_options& opts = bvh_options()) {
+    if (!compiled || !matches(world)) {
+      objects = world.objects;
+      boxes.clear();
+      for (const auto& object : objects)
+        boxes.push_back(object->bounding_box());
+      compiled = compile_scene(world, opts);
+    }
+    return compiled;
+  }
+
+  void clear() {
+    objects.clear();
+    boxes.clear();
+    compiled.reset();
+  }
+
+private:
+  std::vector<shared_ptr<hittable>> objects;
+  std::vector<aabb> boxes;
+  shared_ptr<hittable> compiled;
+
+  bool matches(const hittable_list& world) const {
+    if (world.objects.size() != objects.size())
+      return false;
+    for (size_t i = 0; i < objects.size(); ++i) {
+      if (world.objects[i] != objects[i])
+        return false;
+      auto box = objects[i]->bounding_box();
+      for (int a = 0; a < 3; ++a)
+        if (box.axis(a).min != boxes[i].axis(a).min || box.axis(a).max != boxes[i].axis(a).max)
+          return false;
+    }
+    return true;
+  }
+};
+
+#endif
@@ -1,4 +1,4 @@
-#ifndef CONSTANT_MEDIUM_H
+﻿#ifndef CONSTANT_MEDIUM_H
 #define CONSTANT_MEDIUM_H
 
 #include "common.h"
@@ -18,54 +18,54 @@ public:
   {}
 
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-    // Print occasional samples when debugging. To enable, set enableDebug true.
-    const bool enableDebug = false;
-    const bool debugging = enableDebug && random_double() < 0.00001;
-
-    hit_record rec1, rec2;
-
-    if (!boundary->hit(r, interval::universe, rec1))
-      return false;
-
-    if (!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2))
-      return false;
-
-    if (debugging) std::clog << "\nray_tmin=" << rec1.t << ", ray_tmax=" << rec2.t << '\n';
-
-    if (rec1.t < ray_t.min) rec1.t = ray_t.min;
-    if (rec2.t > ray_t.max) rec2.t = ray_t.max;
-
-    if (rec1.t >= rec2.t)
-      return false;
-
-    if (rec1.t < 0)
-      rec1.t = 0;
+    // 一次查询得到光线在边界内的所有区间(球、box_prim 解析求出)，不再两次完整求交
+    span_list spans;
+    boundary->hit_intervals(r, spans);
 
+    // 自由程按落在 ray_t 内的各段依次扣除，边界由几段组成时介质仍是同一个
     auto ray_length = r.direction().length();
-    auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-    auto hit_distance = neg_inv_density * log(random_double());
-
-    if (hit_distance > distance_inside_boundary)
-      return false;
-
-    rec.t = rec1.t + hit_distance / ray_length;
-    rec.p = r.at(rec.t);
-
-    if (debugging) {
-      std::clog << "hit_distance = " << hit_distance << '\n'
-        << "rec.t = " << rec.t << '\n'
-        << "rec.p = " << rec.p << '\n';
+    double hit_distance = -1;
+    while (true) {
+      for (int i = 0; i < spans.count; ++i) {
+        auto t0 = fmax(spans.spans[i].min, fmax(ray_t.min, 0.0));
+        auto t1 = fmin(spans.spans[i].max, ray_t.max);
+        if (t0 >= t1)
+          continue;
+
+        // 自由程取自弹射的 PCG32 流，不占采样器维度(同 heterogeneous_medium)
+        if (hit_distance < 0)
+          hit_distance = neg_inv_density * log(1 - random_stream_double());
+        auto distance_inside_boundary = (t1 - t0) * ray_length;
+        if (hit_distance > distance_inside_boundary) {
+          hit_distance -= distance_inside_boundary;
+          continue;
+        }
+
+        rec.t = t0 + hit_distance / ray_length;
+        rec.p = r.at(rec.t);
+
+        rec.normal = vec3(1, 0, 0);  // arbitrary
+        rec.front_face = true;     // also arbitrary
+        rec.mat_ptr = phase_function.get();
+
+        return true;
+      }
+
+      // 区间多于 span_list 的容量：从最后一段之后按两次求交继续查询
+      if (!spans.overflow)
+        return false;
+      auto resume = spans.spans[spans.count - 1].max + 0.0001;
+      if (resume >= ray_t.max)
+        return false;
+      spans.clear();
+      boundary->hit_intervals_from(r, resume, spans);
     }
-
-    rec.normal = vec3(1, 0, 0);  // arbitrary
-    rec.front_face = true;     // also arbitrary
-    rec.mat_ptr = phase_function;
-
-    return true;
   }
 
   aabb bounding_box() const override { return boundary->bounding_box(); }
 
+  bool stochastic_hit() const override { return true; }
+
 private:
   shared_ptr<hittable> boundary;
   double neg_inv_density;
@@ -0,0 +1,73 @@
+﻿#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "common.h"
+
+#include <algorithm>
+#include <vector>
+
+// 渲染结果缓冲：按行存储每个像素的线性 rgb(float)，各渲染线程写入互不重叠的 tile。
+// 也可以只覆盖图像中的一块区域：(origin_x, origin_y) 是这块区域左上角在整幅图中的坐标，set/get 仍使用整幅图的坐标
+class framebuffer {
+public:
+  framebuffer() : image_width(0), image_height(0) {}
+
+  framebuffer(int width, int height, int origin_x = 0, int origin_y = 0) {
+    reset(width, height, origin_x, origin_y);
+  }
+
+  // 改变覆盖的区域，已分配的内存可以重复使用
+  void reset(int width, int height, int origin_x = 0, int origin_y = 0) {
+    image_width = width;
+    image_height = height;
+    x0 = origin_x;
+    y0 = origin_y;
+    pixels.assign(static_cast<size_t>(width) * height * 3, 0.0f);
+  }
+
+  int width() const { return image_width; }
+  int height() const { return image_height; }
+  int origin_x() const { return x0; }
+  int origin_y() const { return y0; }
+
+  void set(int i, int j, const color& c) {
+    auto p = &pixels[index(i, j)];
+    p[0] = static_cast<float>(c.x());
+    p[1] = static_cast<float>(c.y());
+    p[2] = static_cast<float>(c.z());
+  }
+
+  color get(int i, int j) const {
+    auto p = &pixels[index(i, j)];
+    return color(p[0], p[1], p[2]);
+  }
+
+  const float* data() const { return pixels.data(); }
+  float* data() { return pixels.data(); }
+
+private:
+  int image_width;
+  int image_height;
+  int x0 = 0;
+  int y0 = 0;
+  std::vector<float> pixels;
+
+  size_t index(int i, int j) const {
+    return (static_cast<size_t>(j - y0) * image_width + (i - x0)) * 3;
+  }
+};
+
+// 图像上的一块矩形区域 [x0,x1) x [y0,y1)
+struct tile {
+  int x0, y0, x1, y1;
+};
+
+inline std::vector<tile> make_tiles(int width, int height, int tile_size) {
+  std::vector<tile> tiles;
+  for (int y = 0; y < height; y += tile_size)
+    for (int x = 0; x < width; x += tile_size)
+      tiles.push_back({ x, y, std::min(x + tile_size, width), std::min(y + tile_size, height) });
+  return tiles;
+}
+
+#endif
@@ -0,0 +1,247 @@
+﻿#ifndef GRID_H
+#define GRID_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+struct grid_options {
+  double density = 4;            // 单元格数 ≈ density × 物体数，单元格取接近立方体的形状
+  int max_resolution = 128;      // 每个轴最多的单元格数
+  bool two_level = false;        // 物体过多的单元格里再建一层子网格
+  int subgrid_threshold = 32;    // two_level：单元格中物体数超过该值才建子网格
+  bool report = true;            // 构建完成后输出耗时和内存
+};
+
+// 均匀网格：把包围盒均分成单元格，每个单元格记录和它重叠的物体。
+// 光线用 3D-DDA 按穿过的顺序逐个走单元格，最近的交点落在已走过的单元格里就停下，
+// 物体分布均匀、大小相近时(铺满的地面方块、规则排列的小球)往往比 BVH 快。
+// 和 bvh_node 一样由 hittable_list 构建，可以按子场景分别选用
+class grid_accel : public hittable {
+public:
+  grid_accel(const hittable_list& list, const grid_options& opts = grid_options())
+    : grid_accel(list.objects, opts) {}
+
+  grid_accel(const std::vector<shared_ptr<hittable>>& src_objects, const grid_options& opts = grid_options())
+    : objects(src_objects), primitive_count(src_objects.size()) {
+    auto build_start = std::chrono::steady_clock::now();
+    build(opts);
+
+    if (opts.report) {
+      size_t memory = cell_start.size() * sizeof(uint32_t) + cell_items.size() * sizeof(uint32_t)
+        + objects.size() * sizeof(shared_ptr<hittable>);
+      std::clog << "grid_accel: " << src_objects.size() << " objects, " << res[0] << "x" << res[1] << "x" << res[2]
+        << " cells (" << subgrids << " subgrids), " << cell_items.size() << " references, "
+        << elapsed_ms(build_start) << " ms, " << memory / 1024.0 / 1024.0 << " MB\n";
+    }
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    // 先把光线裁剪到网格的包围盒内
+    double t_enter = ray_t.min, t_exit = ray_t.max;
+    double inv_dir[3];
+    for (int a = 0; a < 3; a++) {
+      inv_dir[a] = 1 / r.direction()[a];
+      auto t0 = (bbox.axis(a).min - r.origin()[a]) * inv_dir[a];
+      auto t1 = (bbox.axis(a).max - r.origin()[a]) * inv_dir[a];
+      if (inv_dir[a] < 0)
+        std::swap(t0, t1);
+      if (t0 > t_enter) t_enter = t0;
+      if (t1 < t_exit) t_exit = t1;
+      if (t_exit < t_enter)
+        return false;
+    }
+
+    // 进入点所在的单元格，以及沿每个轴穿过下一个单元格边界的 t
+    int cell[3], step[3], out[3];
+    double t_next[3], t_delta[3];
+    for (int a = 0; a < 3; a++) {
+      auto p = r.origin()[a] + t_enter * r.direction()[a];
+      cell[a] = std::clamp(static_cast<int>((p - bbox.axis(a).min) * inv_cell[a]), 0, res[a] - 1);
+      if (r.direction()[a] == 0) {
+        step[a] = 0;
+        out[a] = -1;
+        t_next[a] = t_delta[a] = infinity;
+        continue;
+      }
+      t_delta[a] = cell_size[a] * std::fabs(inv_dir[a]);
+      if (r.direction()[a] > 0) {
+        step[a] = 1;
+        out[a] = res[a];
+        t_next[a] = (bbox.axis(a).min + (cell[a] + 1) * cell_size[a] - r.origin()[a]) * inv_dir[a];
+      }
+      else {
+        step[a] = -1;
+        out[a] = -1;
+        t_next[a] = (bbox.axis(a).min + cell[a] * cell_size[a] - r.origin()[a]) * inv_dir[a];
+      }
+    }
+
+    // 邮箱：记下最近测过的物体，跨多个单元格的物体不再重复求交。
+    // 测过的物体的交点无论是否落在当前单元格内都已计入最近交点，所以跳过它们不会漏掉交点。
+    // 放在栈上而不是按物体存光线编号，多线程渲染不需要同步
+    uint32_t mailbox[mailbox_size];
+    std::fill(mailbox, mailbox + mailbox_size, ~0u);
+
+    bool hit_anything = false;
+    for (;;) {
+      auto index = (cell[2] * res[1] + cell[1]) * res[0] + cell[0];
+      for (auto i = cell_start[index]; i < cell_start[index + 1]; ++i) {
+        auto id = cell_items[i];
+        auto& slot = mailbox[id & (mailbox_size - 1)];
+        if (slot == id)
+          continue;
+        slot = id;
+        if (objects[id]->hit(r, ray_t, rec)) {
+          hit_anything = true;
+          ray_t.max = rec.t;
+        }
+      }
+
+      // 离开这个单元格的轴
+      int a = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+      if (ray_t.max <= t_next[a] || t_next[a] > t_exit)
+        break; // 最近的交点已在走过的单元格里，或者光线已离开网格
+      cell[a] += step[a];
+      if (cell[a] == out[a])
+        break;
+      t_next[a] += t_delta[a];
+    }
+    return hit_anything;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    for (size_t i = 0; i < primitive_count; ++i)
+      objects[i]->gather_lights(lights);
+  }
+
+  bool stochastic_hit() const override {
+    for (size_t i = 0; i < primitive_count; ++i)
+      if (objects[i]->stochastic_hit())
+        return true;
+    return false;
+  }
+
+private:
+  static constexpr int mailbox_size = 8; // 2 的幂
+
+  std::vector<shared_ptr<hittable>> objects; // 前 primitive_count 个是构建时给出的物体，之后是子网格
+  size_t primitive_count = 0;
+  std::vector<uint32_t> cell_start;          // 单元格 c 的物体编号是 cell_items[cell_start[c], cell_start[c + 1])
+  std::vector<uint32_t> cell_items;
+  aabb bbox;
+  int res[3] = { 1, 1, 1 };
+  double cell_size[3] = { 0, 0, 0 };
+  double inv_cell[3] = { 0, 0, 0 };
+  int subgrids = 0;
+
+  // 物体包围盒覆盖的单元格范围 [lo, hi]
+  void cell_range(const aabb& box, int lo[3], int hi[3]) const {
+    for (int a = 0; a < 3; a++) {
+      lo[a] = std::clamp(static_cast<int>((box.axis(a).min - bbox.axis(a).min) * inv_cell[a]), 0, res[a] - 1);
+      hi[a] = std::clamp(static_cast<int>((box.axis(a).max - bbox.axis(a).min) * inv_cell[a]), 0, res[a] - 1);
+    }
+  }
+
+  void build(const grid_options& opts) {
+    for (const auto& object : objects)
+      bbox = aabb(bbox, object->bounding_box());
+    auto n = objects.size();
+    if (n == 0) {
+      cell_start.assign(2, 0);
+      return;
+    }
+
+    // 自动分辨率：单元格边长 s 满足 体积 / s^3 ≈ density × n(Cleary & Wyvill)，
+    // 很薄的轴按其他两轴计算，每个轴至少一个单元格
+    double extent[3], volume = 1;
+    int thick_axes = 0;
+    double max_extent = 0;
+    for (int a = 0; a < 3; a++) {
+      extent[a] = bbox.axis(a).size();
+      max_extent = std::max(max_extent, extent[a]);
+    }
+    for (int a = 0; a < 3; a++) {
+      if (extent[a] > 1e-3 * max_extent) {
+        volume *= extent[a];
+        ++thick_axes;
+      }
+    }
+    auto cells_wanted = std::max(1.0, opts.density * n);
+    auto s = thick_axes > 0 ? std::pow(volume / cells_wanted, 1.0 / thick_axes) : 1.0;
+    for (int a = 0; a < 3; a++) {
+      res[a] = s > 0 ? std::clamp(static_cast<int>(std::ceil(extent[a] / s)), 1, opts.max_resolution) : 1;
+      cell_size[a] = extent[a] / res[a];
+      inv_cell[a] = cell_size[a] > 0 ? 1 / cell_size[a] : 0;
+    }
+
+    // 两遍：先数每个单元格的物体数，再填入编号
+    size_t cell_count = static_cast<size_t>(res[0]) * res[1] * res[2];
+    cell_start.assign(cell_count + 1, 0);
+    std::vector<aabb> boxes(n);
+    for (size_t i = 0; i < n; ++i) {
+      boxes[i] = objects[i]->bounding_box();
+      for_each_cell(boxes[i], [&](size_t c) { ++cell_start[c + 1]; });
+    }
+    for (size_t c = 0; c < cell_count; ++c)
+      cell_start[c + 1] += cell_start[c];
+    cell_items.resize(cell_start[cell_count]);
+    std::vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+    for (size_t i = 0; i < n; ++i)
+      for_each_cell(boxes[i], [&](size_t c) { cell_items[fill[c]++] = static_cast<uint32_t>(i); });
+
+    if (opts.two_level && n > static_cast<size_t>(opts.subgrid_threshold))
+      build_subgrids(opts);
+  }
+
+  template <typename Visit>
+  void for_each_cell(const aabb& box, Visit visit) const {
+    int lo[3], hi[3];
+    cell_range(box, lo, hi);
+    for (int z = lo[2]; z <= hi[2]; ++z)
+      for (int y = lo[1]; y <= hi[1]; ++y)
+        for (int x = lo[0]; x <= hi[0]; ++x)
+          visit((static_cast<size_t>(z) * res[1] + y) * res[0] + x);
+  }
+
+  // 物体过多的单元格换成一个子网格，单元格里只留下子网格一个物体。
+  // 子网格和所有物体一样返回整条光线上的最近交点，所以它的包围盒超出单元格也不影响正确性
+  void build_subgrids(const grid_options& opts) {
+    auto sub_opts = opts;
+    sub_opts.two_level = false;
+    sub_opts.report = false;
+
+    size_t cell_count = cell_start.size() - 1;
+    std::vector<uint32_t> new_start(cell_count + 1, 0), new_items;
+    new_items.reserve(cell_items.size());
+    for (size_t c = 0; c < cell_count; ++c) {
+      auto first = cell_start[c], last = cell_start[c + 1];
+      if (last - first > static_cast<uint32_t>(opts.subgrid_threshold)) {
+        std::vector<shared_ptr<hittable>> members;
+        for (auto i = first; i < last; ++i)
+          members.push_back(objects[cell_items[i]]);
+        new_items.push_back(static_cast<uint32_t>(objects.size()));
+        objects.push_back(make_shared<grid_accel>(members, sub_opts));
+        ++subgrids;
+      }
+      else
+        new_items.insert(new_items.end(), cell_items.begin() + first, cell_items.begin() + last);
+      new_start[c + 1] = static_cast<uint32_t>(new_items.size());
+    }
+    cell_start.swap(new_start);
+    cell_items.swap(new_items);
+  }
+};
+
+#endif
@@ -4,13 +4,17 @@
 #include "common.h"
 #include "ray.h"
 #include "aabb.h"
+#include "ray_packet.h"
+#include "transform.h"
+
+#include <vector>
 
 class material;
 
 struct hit_record { 
   point3 p;
   vec3 normal; // 击中处法向量
-  shared_ptr<material> mat_ptr;
+  const material* mat_ptr; // 不持有材质(材质由物体持有)，求交时不做原子引用计数
   double t;
 
   // 光线和物体击中点的表面坐标uv
@@ -24,6 +28,28 @@ struct hit_record {
   }
 };
 
+// 光线在封闭物体内部的各段 t 区间(沿整条直线，不受 ray_t 限制)，按 t 从小到大排列、互不重叠。
+// 容量固定，放在栈上，每次查询不分配内存；超出容量的区间不保存，只置位 overflow，
+// 调用方用完已有的区间后用 hittable::hit_intervals_from 从最后一段之后继续查询
+struct span_list {
+  static constexpr int capacity = 8;
+  interval spans[capacity];
+  int count = 0;
+  bool overflow = false;
+
+  void add(const interval& span) {
+    if (count < capacity)
+      spans[count++] = span;
+    else
+      overflow = true;
+  }
+
+  void clear() {
+    count = 0;
+    overflow = false;
+  }
+};
+
 class hittable {
 public:
   virtual ~hittable() = default;
@@ -32,6 +58,74 @@ public:
   virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
   virtual aabb bounding_box() const = 0; // 所有可碰撞物体要实现aab方法以支持bvh查询
+
+  // 时间 0 和时间 1 的包围盒，中间任意时刻物体都在两者的线性插值之内。
+  // motion_bvh 用它代替覆盖整条轨迹的 bounding_box；默认两端都取 bounding_box，对任何物体都成立
+  virtual void motion_bounds(aabb& start, aabb& end) const {
+    start = end = bounding_box();
+  }
+
+  // 光线穿过封闭物体的所有进入、离开区间，constant_medium 用它一次查询得到介质的边界。
+  // 默认按 hit 依次找进入点和离开点(每段两次完整的求交)，hittable_list、BVH 等容器也这样，
+  // 因为其中的物体可能是不封闭的面(box_quads)；球、box_prim 解析求出，变换类物体变换光线后转交
+  virtual void hit_intervals(const ray& r, span_list& spans) const {
+    hit_intervals_from(r, -infinity, spans);
+  }
+
+  // 从 t 开始按 hit 依次找进入点和离开点；容量用完后再找到一段时置位 overflow 并返回
+  void hit_intervals_from(const ray& r, double t, span_list& spans) const {
+    hit_record enter, exit;
+    while (!spans.overflow) {
+      if (!hit(r, interval(t, infinity), enter))
+        return;
+      if (!hit(r, interval(enter.t + 0.0001, infinity), exit))
+        return;
+      spans.add(interval(enter.t, exit.t));
+      t = exit.t + 0.0001;
+    }
+  }
+
+  // 光线包求交：对 packet.active 中的每条光线求 (tmin, tmax) 内最近的交点，
+  // 找到更近交点的光线写入 rec[i]、缩小 tmax[i] 并置位 hit_mask。
+  // 默认逐条调用 hit；wide_bvh、motion_bvh 和 sphere_set 重写为跨光线的 SIMD 版本，其他图元用这里的逐条版本。
+  virtual void hit_packet(ray_packet& packet, hit_record* rec) const {
+    for (uint32_t m = packet.active; m; m &= m - 1) {
+      int i = lowest_set_bit(m);
+      if (hit(packet.get(i), interval(packet.tmin[i], packet.tmax[i]), rec[i])) {
+        packet.tmax[i] = rec[i].t;
+        packet.hit_mask |= 1u << i;
+      }
+    }
+  }
+
+  // 光源采样：从 origin 沿 direction 击中本物体的概率密度(对立体角)，
+  // 以及从 origin 指向本物体表面随机一点的方向。只有能作为光源的图元(quad、静止的 sphere)实现
+  virtual double pdf_value(const point3& origin, const vec3& direction) const {
+    return 0.0;
+  }
+
+  virtual vec3 random(const point3& origin) const {
+    return vec3(1, 0, 0);
+  }
+
+  // 收集发光的图元供光源采样使用，容器类物体转交给它包含的物体。
+  // instance 把物体里的光源变换到世界空间再收集；translate/rotate_y 包装的物体不收集，只能靠 BSDF 采样命中
+  virtual void gather_lights(std::vector<const hittable*>& lights) const {}
+
+  // hit 是否会调用 random_double(参与介质按随机自由程决定散射点)，容器转交给它包含的物体。
+  // 相机按光线包求交时随机数还停在上一个像素的序列上，有这样的物体时第一次求交改为逐条进行
+  virtual bool stochastic_hit() const { return false; }
+
+  // 动画中物体移动之后，让容器重新读取内部物体、更新缓存的包围盒等数据(BVH 自底向上重算节点包围盒)。
+  // 移动物体本身的接口(sphere::move_to、instance::set_transform)会立即更新自己的包围盒，不需要 refit
+  virtual void refit() {}
+
+protected:
+  static int lowest_set_bit(uint32_t mask) {
+    int i = 0;
+    while (!(mask & (1u << i))) ++i;
+    return i;
+  }
 };
 
 // 实例化：平移物体
@@ -57,8 +151,18 @@ public:
     return true;
   }
 
+  void hit_intervals(const ray& r, span_list& spans) const override {
+    object->hit_intervals(ray(r.origin() - offset, r.direction(), r.time()), spans);
+  }
+
   aabb bounding_box() const override { return bbox; }
 
+  // 场景编译(compile.h)把平移、旋转的嵌套合并成一个 instance 时读取
+  bool stochastic_hit() const override { return object->stochastic_hit(); }
+
+  const shared_ptr<hittable>& wrapped() const { return object; }
+  transform object_to_world() const { return transform::translate(offset); }
+
 private:
   shared_ptr<hittable> object;
   vec3 offset;
@@ -101,16 +205,7 @@ public:
 
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
     // Change the ray from world space to object space
-    auto origin = r.origin();
-    auto direction = r.direction();
-
-    origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-    origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-
-    direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-    direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-
-    ray rotated_r(origin, direction, r.time());
+    auto rotated_r = to_object(r);
 
     // Determine where (if any) an intersection occurs in object space
     if (!object->hit(rotated_r, ray_t, rec))
@@ -134,11 +229,41 @@ public:
 
   aabb bounding_box() const override { return bbox; }
 
+  void hit_intervals(const ray& r, span_list& spans) const override {
+    object->hit_intervals(to_object(r), spans);
+  }
+
+  bool stochastic_hit() const override { return object->stochastic_hit(); }
+
+  const shared_ptr<hittable>& wrapped() const { return object; }
+  transform object_to_world() const {
+    const double m[4][4] = {
+      {  cos_theta, 0, sin_theta, 0 },
+      {          0, 1,         0, 0 },
+      { -sin_theta, 0, cos_theta, 0 },
+      {          0, 0,         0, 1 }
+    };
+    return transform(m);
+  }
+
 private:
   shared_ptr<hittable> object;
   double sin_theta;
   double cos_theta;
   aabb bbox;
+
+  ray to_object(const ray& r) const {
+    auto origin = r.origin();
+    auto direction = r.direction();
+
+    origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
+    origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
+
+    direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
+    direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
+
+    return ray(origin, direction, r.time());
+  }
 };
 
 #endif
\ No newline at end of file
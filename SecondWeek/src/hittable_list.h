@@ -22,8 +22,26 @@ public:
   }
 
   virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
+
+  void hit_packet(ray_packet& packet, hit_record* rec) const override {
+    // 每个物体都按整包求交，物体内部的加速结构也能整包遍历
+    for (const auto& object : objects)
+      object->hit_packet(packet, rec);
+  }
   aabb bounding_box() const override { return bbox; }
 
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    for (const auto& object : objects)
+      object->gather_lights(lights);
+  }
+
+  bool stochastic_hit() const override {
+    for (const auto& object : objects)
+      if (object->stochastic_hit())
+        return true;
+    return false;
+  }
+
 public:
   std::vector<shared_ptr<hittable>> objects;
 
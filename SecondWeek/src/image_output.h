@@ -0,0 +1,126 @@
+﻿#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+
+// Disable strict warnings for this header from the Microsoft Visual C++ compiler.
+#ifdef _MSC_VER
+#pragma warning (push, 0)
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stb_image_write.h"
+
+#ifdef _MSC_VER
+#pragma warning (pop)
+#endif
+
+#include "framebuffer.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// 输出阶段：整幅 framebuffer 一次完成色调映射和 gamma，再一次性写入文件。
+// 按扩展名选择格式：.png / .hdr / .pfm，其余按二进制 PPM 输出。
+enum class image_format {
+  ppm,
+  png,
+  hdr,
+  pfm
+};
+
+inline image_format format_from_path(const std::string& path) {
+  auto dot = path.find_last_of('.');
+  if (dot == std::string::npos)
+    return image_format::ppm;
+
+  auto ext = path.substr(dot + 1);
+  for (auto& c : ext)
+    c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+
+  if (ext == "png") return image_format::png;
+  if (ext == "hdr") return image_format::hdr;
+  if (ext == "pfm") return image_format::pfm;
+  return image_format::ppm;
+}
+
+// 线性颜色转 8 位：截断到 [0, 1)(色调映射)，gamma = 2.0 取平方根，和 write_color6 相同。
+// apply_gamma 为 false 时直接量化，用于样本数这类数据图。
+// x86 上每次用 SSE 转换 4 个分量，NaN 和负数都变成 0。
+inline void encode_8bit(const float* rgb, size_t count, uint8_t* out, bool apply_gamma = true) {
+  size_t k = 0;
+#if RT_SIMD_X86
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 scale = _mm_set1_ps(256.0f);
+  const __m128 top = _mm_set1_ps(256 * 0.999f);
+  for (; k + 4 <= count; k += 4) {
+    __m128 v = _mm_max_ps(_mm_loadu_ps(rgb + k), zero);
+    if (apply_gamma)
+      v = _mm_sqrt_ps(v);
+    v = _mm_min_ps(_mm_mul_ps(v, scale), top);
+    alignas(16) int32_t bytes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(bytes), _mm_cvttps_epi32(v));
+    out[k] = static_cast<uint8_t>(bytes[0]);
+    out[k + 1] = static_cast<uint8_t>(bytes[1]);
+    out[k + 2] = static_cast<uint8_t>(bytes[2]);
+    out[k + 3] = static_cast<uint8_t>(bytes[3]);
+  }
+#endif
+  for (; k < count; ++k) {
+    float v = rgb[k] > 0 ? rgb[k] : 0;
+    if (apply_gamma)
+      v = std::sqrt(v);
+    v = std::fmin(v * 256.0f, 256 * 0.999f);
+    out[k] = static_cast<uint8_t>(v);
+  }
+}
+
+inline std::vector<uint8_t> encode_8bit(const framebuffer& image, bool apply_gamma = true) {
+  size_t count = static_cast<size_t>(image.width()) * image.height() * 3;
+  std::vector<uint8_t> bytes(count);
+  encode_8bit(image.data(), count, bytes.data(), apply_gamma);
+  return bytes;
+}
+
+inline bool write_ppm(const framebuffer& image, const std::string& path, bool apply_gamma = true) {
+  auto bytes = encode_8bit(image, apply_gamma);
+  std::ofstream out(path, std::ios::out | std::ios::binary);
+  out << "P6\n" << image.width() << ' ' << image.height() << "\n255\n";
+  out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  return static_cast<bool>(out);
+}
+
+// PFM 存线性 float，行从下往上排列，scale 为负表示小端
+inline bool write_pfm(const framebuffer& image, const std::string& path) {
+  size_t row = static_cast<size_t>(image.width()) * 3;
+  std::vector<float> flipped(row * image.height());
+  for (int j = 0; j < image.height(); ++j)
+    std::copy(image.data() + j * row, image.data() + (j + 1) * row, flipped.begin() + (image.height() - 1 - j) * row);
+
+  std::ofstream out(path, std::ios::out | std::ios::binary);
+  out << "PF\n" << image.width() << ' ' << image.height() << "\n-1.0\n";
+  out.write(reinterpret_cast<const char*>(flipped.data()), flipped.size() * sizeof(float));
+  return static_cast<bool>(out);
+}
+
+// 按扩展名写出图像；HDR/PFM 保存未经映射的线性颜色
+inline bool write_image(const framebuffer& image, const std::string& path, bool apply_gamma = true) {
+  switch (format_from_path(path)) {
+  case image_format::png: {
+    auto bytes = encode_8bit(image, apply_gamma);
+    return stbi_write_png(path.c_str(), image.width(), image.height(), 3, bytes.data(), image.width() * 3) != 0;
+  }
+  case image_format::hdr:
+    return stbi_write_hdr(path.c_str(), image.width(), image.height(), 3, image.data()) != 0;
+  case image_format::pfm:
+    return write_pfm(image, path);
+  default:
+    return write_ppm(image, path, apply_gamma);
+  }
+}
+
+#endif
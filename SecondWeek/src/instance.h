@@ -0,0 +1,115 @@
+﻿#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "common.h"
+
+#include "hittable.h"
+#include "transform.h"
+
+#include <vector>
+
+// 实例：用一个仿射变换摆放共享的物体(通常是一棵 BVH)。光线进入实例时只变换一次到物体空间，
+// 方向不归一化，所以 t 在两个空间中相同，不用换算 ray_t。
+// 同一个物体可以被成千上万个实例引用，每个实例只多占一个变换和包围盒；
+// 再在实例之上建一棵 BVH(bvh_node、linear_bvh、bvh4/bvh8 都可以)就是两级加速结构
+class instance : public hittable {
+public:
+  instance(shared_ptr<const hittable> object, const transform& object_to_world)
+    : object(object) {
+    set_transform(object_to_world);
+
+    // 物体内部的每个光源都要在世界空间中采样，给它们各建一个同样变换的实例(和 object 共享所有权)
+    std::vector<const hittable*> inner;
+    this->object->gather_lights(inner);
+    for (auto light : inner) {
+      if (light == this->object.get())
+        is_light = true; // 物体本身就是光源，由这个实例代表
+      else
+        light_parts.push_back(make_shared<instance>(shared_ptr<const hittable>(this->object, light), xf));
+    }
+  }
+
+  // 动画中移动实例：换一个变换，包围盒和内部光源的实例一起更新。之后要 refit 包含它的 BVH
+  void set_transform(const transform& object_to_world) {
+    xf = object_to_world;
+    bbox = xf.box(object->bounding_box());
+    inv_det = xf.inverse_determinant();
+    for (auto& part : light_parts)
+      part->set_transform(object_to_world);
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    ray local(xf.inverse_point(r.origin()), xf.inverse_vector(r.direction()), r.time());
+    if (!object->hit(local, ray_t, rec))
+      return false;
+
+    // 仿射变换保持 dot(方向, 法线) 的符号，front_face 不变
+    rec.p = r.at(rec.t);
+    rec.normal = unit_vector(xf.normal(rec.normal));
+    return true;
+  }
+
+  // 整个光线包一起变换到物体空间，交给物体按包遍历，再把新找到的交点变换回来
+  void hit_packet(ray_packet& packet, hit_record* rec) const override {
+    ray_packet local = packet;
+    for (uint32_t m = packet.active; m; m &= m - 1) {
+      int i = lowest_set_bit(m);
+      auto o = xf.inverse_point(point3(packet.ox[i], packet.oy[i], packet.oz[i]));
+      auto d = xf.inverse_vector(vec3(packet.dx[i], packet.dy[i], packet.dz[i]));
+      local.ox[i] = o.x(); local.oy[i] = o.y(); local.oz[i] = o.z();
+      local.dx[i] = d.x(); local.dy[i] = d.y(); local.dz[i] = d.z();
+    }
+
+    object->hit_packet(local, rec);
+
+    for (uint32_t m = packet.active; m; m &= m - 1) {
+      int i = lowest_set_bit(m);
+      if (local.tmax[i] < packet.tmax[i]) {
+        rec[i].p = packet.get(i).at(rec[i].t);
+        rec[i].normal = unit_vector(xf.normal(rec[i].normal));
+        packet.tmax[i] = local.tmax[i];
+        packet.hit_mask |= 1u << i;
+      }
+    }
+  }
+
+  // 方向不归一化，物体空间的区间就是世界空间的区间
+  void hit_intervals(const ray& r, span_list& spans) const override {
+    object->hit_intervals(ray(xf.inverse_point(r.origin()), xf.inverse_vector(r.direction()), r.time()), spans);
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  // 物体空间的方向 A u 和世界空间的方向 u 之间，立体角相差 |det A| / |A u|^3(A 为逆变换)
+  double pdf_value(const point3& origin, const vec3& direction) const override {
+    auto local_dir = xf.inverse_vector(unit_vector(direction));
+    auto pdf = object->pdf_value(xf.inverse_point(origin), local_dir);
+    if (pdf <= 0)
+      return 0;
+    auto len = local_dir.length();
+    return pdf * inv_det / (len * len * len);
+  }
+
+  vec3 random(const point3& origin) const override {
+    return xf.vector(object->random(xf.inverse_point(origin)));
+  }
+
+  void gather_lights(std::vector<const hittable*>& out) const override {
+    if (is_light)
+      out.push_back(this);
+    for (const auto& part : light_parts)
+      out.push_back(part.get());
+  }
+
+  bool stochastic_hit() const override { return object->stochastic_hit(); }
+
+private:
+  shared_ptr<const hittable> object;
+  transform xf;
+  aabb bbox;
+  double inv_det;
+  bool is_light = false;
+  std::vector<shared_ptr<instance>> light_parts;
+};
+
+#endif
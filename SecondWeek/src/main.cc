@@ -8,9 +8,16 @@
 #include "camera.h"
 #include "material.h"
 #include "bvh.h"
+#include "bvh_linear.h"
+#include "bvh_wide.h"
+#include "grid.h"
 #include "texture.h"
 #include "quad.h"
+#include "box.h"
 #include "constant_medium.h"
+#include "volume.h"
+#include "instance.h"
+#include "animation.h"
 #include "bvh.h"
 
 void random_spheres() {
@@ -66,6 +73,9 @@ void random_spheres() {
   auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
   world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
 
+  // 不用自己套 BVH：render 会编译 world(compile.h)，漫反射的小球在移动，所以建的是 motion_bvh。
+  // 22x22 排列的小球也可以用 grid_accel(world)
+
   // Camera
   camera cam;
 
@@ -243,16 +253,11 @@ void cornell_box() {
   // 加入两个矩形
   //world.add(box(point3(130, 0, 65), point3(295, 165, 230), white));
   //world.add(box(point3(265, 0, 295), point3(430, 330, 460), white));
-  shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
   //先旋转后平移
-  box1 = make_shared<rotate_y>(box1, 15);
-  box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-  world.add(box1);
-
-  shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-  box2 = make_shared<rotate_y>(box2, -18);
-  box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-  world.add(box2);
+  world.add(make_shared<instance>(box(point3(0, 0, 0), point3(165, 330, 165), white),
+                                  transform::translate(vec3(265, 0, 295)) * transform::rotate(vec3(0, 1, 0), 15)));
+  world.add(make_shared<instance>(box(point3(0, 0, 0), point3(165, 165, 165), white),
+                                  transform::translate(vec3(130, 0, 65)) * transform::rotate(vec3(0, 1, 0), -18)));
 
   camera cam;
 
@@ -287,13 +292,10 @@ void cornell_smoke() {
   world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
   world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
 
-  shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-  box1 = make_shared<rotate_y>(box1, 15);
-  box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-
-  shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-  box2 = make_shared<rotate_y>(box2, -18);
-  box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+  auto box1 = make_shared<instance>(box(point3(0, 0, 0), point3(165, 330, 165), white),
+                                    transform::translate(vec3(265, 0, 295)) * transform::rotate(vec3(0, 1, 0), 15));
+  auto box2 = make_shared<instance>(box(point3(0, 0, 0), point3(165, 165, 165), white),
+                                    transform::translate(vec3(130, 0, 65)) * transform::rotate(vec3(0, 1, 0), -18));
 
   world.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
   world.add(make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
@@ -316,7 +318,57 @@ void cornell_smoke() {
   cam.render(world);
 }
 
-void final_scene(int image_width, int samples_per_pixel, int max_depth) {
+// 康奈尔盒子里一团非均匀的烟：perlin 湍流烘焙成密度网格，球形边界内 delta tracking
+void cornell_cloud() {
+  hittable_list world;
+
+  auto red = make_shared<lambertian>(color(.65, .05, .05));
+  auto white = make_shared<lambertian>(color(.73, .73, .73));
+  auto green = make_shared<lambertian>(color(.12, .45, .15));
+  auto light = make_shared<diffuse_light>(color(7, 7, 7));
+
+  world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+  world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+  world.add(make_shared<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
+  world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+  world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+  world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+  // 湍流低于 0.35 的地方没有烟，这些砖块不分配，光线一步跨过
+  perlin noise;
+  auto center = point3(278, 250, 278);
+  auto radius = 200.0;
+  auto bounds = aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius));
+  auto grid = make_shared<density_grid>(bounds, 128, 128, 128, [&](const point3& p) {
+    return fmax(0.0, noise.turb(p * 0.012) - 0.35);
+  });
+  grid->print("density_grid");
+
+  auto boundary = make_shared<sphere>(center, radius, white);
+  auto cloud = make_shared<heterogeneous_medium>(grid, 0.3, color(.9, .9, .9), boundary);
+  world.add(cloud);
+
+  camera cam;
+
+  cam.aspect_ratio = 1.0;
+  cam.image_width = 600;
+  cam.samples_per_pixel = 200;
+  cam.max_depth = 50;
+  cam.background = color(0, 0, 0);
+
+  cam.vfov = 40;
+  cam.lookfrom = point3(278, 278, -800);
+  cam.lookat = point3(278, 278, 0);
+  cam.vup = vec3(0, 1, 0);
+
+  cam.defocus_angle = 0;
+
+  cam.render(world);
+  cloud->report("cloud");
+}
+
+// media 为 false 时去掉两个 constant_medium(用于 check_packet_path)
+hittable_list final_scene_world(bool media = true) {
   hittable_list boxes1;
   auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
 
@@ -337,7 +389,8 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 
   hittable_list world;
 
-  world.add(make_shared<bvh_node>(boxes1));
+  // 地面方块铺满一个平面、大小相同，用均匀网格(和 bvh8 相当，可以换回去比较)
+  world.add(make_shared<grid_accel>(boxes1));
 
   auto light = make_shared<diffuse_light>(color(7, 7, 7));
   world.add(make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
@@ -354,9 +407,11 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 
   auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
   world.add(boundary);
-  world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-  boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-  world.add(make_shared<constant_medium>(boundary, .0001, color(1, 1, 1)));
+  if (media) {
+    world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
+    world.add(make_shared<constant_medium>(boundary, .0001, color(1, 1, 1)));
+  }
 
   auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
   world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
@@ -370,15 +425,13 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
     boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
   }
 
-  world.add(make_shared<translate>(
-    make_shared<rotate_y>(
-      make_shared<bvh_node>(boxes2), 15),
-    vec3(-100, 270, 395)
-    )
-  );
+  world.add(make_shared<instance>(make_shared<bvh8>(boxes2),
+                                  transform::translate(vec3(-100, 270, 395)) * transform::rotate(vec3(0, 1, 0), 15)));
 
-  camera cam;
+  return world;
+}
 
+void final_scene_camera(camera& cam, int image_width, int samples_per_pixel, int max_depth) {
   cam.aspect_ratio = 1.0;
   cam.image_width = image_width;
   cam.samples_per_pixel = samples_per_pixel;
@@ -391,10 +444,188 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
+}
 
+void final_scene(int image_width, int samples_per_pixel, int max_depth) {
+  auto world = final_scene_world();
+  camera cam;
+  final_scene_camera(cam, image_width, samples_per_pixel, max_depth);
   cam.render(world);
 }
 
+// 光线包和逐条追踪应当得到逐位相同的图像。final_scene 的介质在求交时取随机数，有介质时相机光线改为逐条求交；
+// 去掉介质后第一次求交走光线包遍历。两种场景各用 packet_size 8 和 1 渲染一遍，比较输出的 PFM 文件
+void check_packet_path() {
+  for (bool media : { true, false }) {
+    auto world = final_scene_world(media);
+    camera cam;
+    final_scene_camera(cam, 100, 16, 8);
+
+    std::string images[2];
+    int packet_sizes[2] = { 8, 1 };
+    for (int k = 0; k < 2; ++k) {
+      cam.packet_size = packet_sizes[k];
+      cam.output_file = images[k] = "packet_check_" + std::to_string(packet_sizes[k]) + ".pfm";
+      cam.render(world);
+    }
+
+    std::ifstream a(images[0], std::ios::binary), b(images[1], std::ios::binary);
+    std::string bytes_a((std::istreambuf_iterator<char>(a)), std::istreambuf_iterator<char>());
+    std::string bytes_b((std::istreambuf_iterator<char>(b)), std::istreambuf_iterator<char>());
+    bool identical = !bytes_a.empty() && bytes_a == bytes_b;
+    std::clog << "Packet path check (" << (media ? "with" : "without") << " media): "
+      << (identical ? "identical" : "IMAGES DIFFER") << '\n';
+  }
+}
+
+// wide_bvh 的 SIMD 盒子内核应当和标量内核给出相同的命中掩码。最容易出错的是原点正好在 slab 平面上、
+// 方向沿平面的光线(0 x inf = NaN)：对每个孩子包围盒的每个面，沿面内两个轴各发一条这样的光线，逐节点比较
+template <int N>
+int count_boundary_mismatches(const hittable_list& world, simd_level level) {
+  wide_bvh<N> reference(world, bvh_options(), simd_level::scalar);
+  wide_bvh<N> tested(world, bvh_options(), level);
+
+  int mismatches = 0;
+  for (size_t index = 0; index < reference.node_count(); ++index) {
+    for (int slot = 0; slot < N; ++slot) {
+      aabb box;
+      if (!reference.child_bounds(index, slot, box))
+        continue;
+      for (int a = 0; a < 3; ++a) {
+        for (double plane : { box.axis(a).min, box.axis(a).max }) {
+          for (int along : { (a + 1) % 3, (a + 2) % 3 }) {
+            point3 origin((box.x.min + box.x.max) / 2, (box.y.min + box.y.max) / 2, (box.z.min + box.z.max) / 2);
+            vec3 direction(0, 0, 0);
+            origin[a] = plane;
+            origin[along] -= 100;
+            direction[along] = 1;
+            ray r(origin, direction, 0.0);
+            if (reference.child_mask(index, r, interval(0.001, infinity)) != tested.child_mask(index, r, interval(0.001, infinity)))
+              ++mismatches;
+          }
+        }
+      }
+    }
+  }
+  return mismatches;
+}
+
+void check_wide_bvh_boundary() {
+  hittable_list world;
+  auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  for (int i = 0; i < 200; ++i) {
+    point3 corner(random_double(-8, 8), random_double(-8, 8), random_double(-8, 8));
+    world.add(box(corner, corner + vec3(random_double(0.1, 1), random_double(0.1, 1), random_double(0.1, 1)), mat));
+  }
+
+  std::vector<simd_level> levels = { simd_level::sse };
+  if (detect_simd_level() == simd_level::avx2)
+    levels.push_back(simd_level::avx2);
+  for (auto level : levels) {
+    int mismatches4 = count_boundary_mismatches<4>(world, level);
+    int mismatches8 = count_boundary_mismatches<8>(world, level);
+    std::clog << "Boundary ray check (" << (level == simd_level::avx2 ? "avx2" : "sse") << "): bvh4 "
+      << mismatches4 << " mismatches, bvh8 " << mismatches8 << " mismatches\n";
+  }
+}
+
+// 两级加速结构：一团 1000 个球的 BVH 只建一次，用 2000 个随机旋转、缩放的实例摆放，再在实例之上建 BVH
+void sphere_clusters() {
+  hittable_list cluster;
+  shared_ptr<material> white = make_shared<lambertian>(color(.73, .73, .73));
+  shared_ptr<material> tinted = make_shared<metal>(color(0.8, 0.6, 0.4), 0.2);
+  for (int j = 0; j < 1000; j++)
+    cluster.add(make_shared<sphere>(point3::random(-1, 1), 0.05, random_double() < 0.8 ? white : tinted));
+  auto blas = make_shared<bvh8>(cluster);
+
+  hittable_list instances;
+  for (int k = 0; k < 2000; k++) {
+    auto position = point3(random_double(-40, 40), random_double(1, 3), random_double(-40, 40));
+    auto xf = transform::translate(position)
+            * transform::rotate(random_unit_vector(), random_double(0, 360))
+            * transform::scale(vec3(1, 1, 1) * random_double(0.5, 1.5));
+    instances.add(make_shared<instance>(blas, xf));
+  }
+
+  hittable_list world;
+  world.add(make_shared<bvh8>(instances));
+  world.add(make_shared<quad>(point3(-100, 0, -100), vec3(200, 0, 0), vec3(0, 0, 200),
+                              make_shared<lambertian>(color(0.4, 0.5, 0.4))));
+
+  camera cam;
+
+  cam.aspect_ratio = 16.0 / 9.0;
+  cam.image_width = 800;
+  cam.samples_per_pixel = 100;
+  cam.max_depth = 20;
+  cam.background = color(0.70, 0.80, 1.00);
+
+  cam.vfov = 30;
+  cam.lookfrom = point3(0, 25, 60);
+  cam.lookat = point3(0, 0, 0);
+  cam.vup = vec3(0, 1, 0);
+
+  cam.defocus_angle = 0;
+
+  cam.render(world);
+}
+
+// 帧序列：2000 个小球绕 y 轴以不同的角速度公转，相机沿样条绕场景飞行。
+// 每帧只移动球心然后 refit，公转把球打散到 BVH 质量下降太多时才重建
+void orbiting_spheres() {
+  hittable_list objects;
+  objects.add(make_shared<quad>(point3(-50, 0, -50), vec3(100, 0, 0), vec3(0, 0, 100),
+                                make_shared<lambertian>(color(0.4, 0.5, 0.4))));
+
+  struct orbit {
+    shared_ptr<sphere> body;
+    double radius, height, phase, speed;
+  };
+  std::vector<orbit> orbits;
+  for (int i = 0; i < 2000; i++) {
+    auto mat = random_double() < 0.8
+      ? shared_ptr<material>(make_shared<lambertian>(color::random() * color::random()))
+      : shared_ptr<material>(make_shared<metal>(color::random(0.5, 1), random_double(0, 0.3)));
+    orbit o{ make_shared<sphere>(point3(0, 0, 0), 0.2, mat), random_double(2, 12), random_double(0.2, 3),
+             random_double(0, 2 * pi), random_double(0.1, 0.5) * (random_double() < 0.5 ? -1 : 1) };
+    orbits.push_back(o);
+    objects.add(o.body);
+  }
+
+  auto animate = [&](double time) {
+    for (auto& o : orbits) {
+      auto angle = o.phase + 2 * pi * o.speed * time;
+      o.body->move_to(point3(o.radius * cos(angle), o.height, o.radius * sin(angle)));
+    }
+  };
+  animate(0);
+
+  bvh_options opts;
+  opts.report = false;
+  animated_scene scene(objects, 1.3, opts);
+
+  camera_path path;
+  path.add(0.0, point3(0, 6, 26), point3(0, 1, 0), 40);
+  path.add(0.4, point3(20, 10, 10), point3(0, 1, 0), 35);
+  path.add(0.7, point3(8, 18, -14), point3(0, 0, 0), 45);
+  path.add(1.0, point3(-16, 4, -12), point3(2, 1, 0), 30);
+
+  camera cam;
+
+  cam.aspect_ratio = 16.0 / 9.0;
+  cam.image_width = 400;
+  cam.samples_per_pixel = 32;
+  cam.max_depth = 20;
+  cam.background = color(0.70, 0.80, 1.00);
+  cam.vup = vec3(0, 1, 0);
+  cam.defocus_angle = 0;
+
+  sequence_settings settings;
+  settings.frame_count = 48;
+  settings.output_pattern = "orbit_%03d.png";
+  render_sequence(cam, scene, path, settings, animate);
+}
+
 int main() {
   switch (0) {
   case 1:  random_spheres();            break;
@@ -406,6 +637,11 @@ int main() {
   case 7:  cornell_box();               break;
   case 8:  cornell_smoke();             break;
   case 9:  final_scene(800, 10000, 40); break;
+  case 10: sphere_clusters();           break;
+  case 11: orbiting_spheres();          break;
+  case 12: cornell_cloud();             break;
+  case 13: check_packet_path();         break;
+  case 14: check_wide_bvh_boundary();   break;
   default: final_scene(400, 250, 4);    break;
   }
   return 0;
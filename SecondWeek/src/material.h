@@ -2,10 +2,20 @@
 #define MATERIAL_H
 
 #include "common.h"
+#include "onb.h"
 #include "texture.h"
 
 struct hit_record;
 
+// 材质采样一个散射方向的结果。weight = f * cos / pdf，是路径 throughput 要乘上的颜色；
+// specular 表示方向几乎是确定的(镜面反射、折射)，这时 pdf 没有意义，也不做光源采样
+struct bsdf_sample {
+  vec3 direction;
+  color weight;
+  double pdf = 0;
+  bool specular = true;
+};
+
 // scattered：生成一个散射光线scattered
 // attenuation：发生散射时光线的衰减attenuation（颜色）
 class material {
@@ -16,6 +26,31 @@ public:
   }
 
   virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+  // 按材质自身的分布采样一个散射方向，返回 false 表示光线被吸收。
+  // 默认直接使用 scatter 的结果并当作镜面散射处理，只实现了 scatter 的材质不受影响
+  virtual bool sample(const ray& r_in, const hit_record& rec, bsdf_sample& s) const {
+    ray scattered;
+    if (!scatter(r_in, rec, s.weight, scattered))
+      return false;
+    s.direction = scattered.direction();
+    s.pdf = 0;
+    s.specular = true;
+    return true;
+  }
+
+  // 对给定的出射方向求 f * cos(散射函数乘以余弦)
+  virtual color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+    return color(0, 0, 0);
+  }
+
+  // sample 生成 direction 的概率密度(对立体角)
+  virtual double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+    return 0;
+  }
+
+  // 发光材质，所在的图元会被收集为光源
+  virtual bool is_emissive() const { return false; }
 };
 
 // Lambertian漫反射材质
@@ -39,6 +74,25 @@ public:
     return true;
   }
 
+  // 在法线的局部坐标系中按余弦分布采样，f * cos / pdf 正好是 albedo
+  bool sample(const ray& r_in, const hit_record& rec, bsdf_sample& s) const override {
+    onb uvw(rec.normal);
+    s.direction = uvw.transform(random_cosine_direction());
+    s.weight = albedo->value(rec.u, rec.v, rec.p);
+    s.pdf = pdf(r_in, rec, s.direction);
+    s.specular = false;
+    return true;
+  }
+
+  color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+    return albedo->value(rec.u, rec.v, rec.p) * pdf(r_in, rec, direction);
+  }
+
+  double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+    auto cos_theta = dot(rec.normal, unit_vector(direction));
+    return cos_theta < 0 ? 0 : cos_theta / pi;
+  }
+
 public:
   shared_ptr<texture> albedo; // 从单一颜色变为材质（根据位置获得颜色等数据）
 };
@@ -56,6 +110,44 @@ public:
     return (dot(scattered.direction(), rec.normal) > 0);
   }
 
+  // 和 scatter 相同的分布；落到表面以下的方向被吸收，所以接受的方向上 f * cos / pdf = albedo
+  bool sample(const ray& r_in, const hit_record& rec, bsdf_sample& s) const override {
+    vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+    s.direction = reflected + fuzz * random_in_unit_sphere();
+    if (dot(s.direction, rec.normal) <= 0)
+      return false;
+    s.weight = albedo;
+    s.specular = fuzz <= 0;
+    s.pdf = s.specular ? 0 : pdf(r_in, rec, s.direction);
+    return true;
+  }
+
+  color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+    if (dot(direction, rec.normal) <= 0)
+      return color(0, 0, 0);
+    return albedo * pdf(r_in, rec, direction);
+  }
+
+  // 散射方向是 反射方向(单位长)末端 + 半径 fuzz 的球内均匀一点。沿 direction 穿过这个球的弦为 [t1, t2]，
+  // 体积元是 t^2 dt dω，所以对立体角的密度为 (t2^3 - t1^3) / (3V)，V = 4/3 π fuzz^3
+  double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+    if (fuzz <= 0)
+      return 0;
+
+    vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+    auto c = dot(unit_vector(direction), reflected);
+    auto discriminant = fuzz * fuzz - (1 - c * c);
+    if (discriminant <= 0)
+      return 0;
+
+    auto root = sqrt(discriminant);
+    auto t2 = c + root;
+    if (t2 <= 0)
+      return 0;
+    auto t1 = fmax(0.0, c - root);
+    return (t2 * t2 * t2 - t1 * t1 * t1) / (4 * pi * fuzz * fuzz * fuzz);
+  }
+
 public:
   color albedo;
   double fuzz;
@@ -113,6 +205,8 @@ public:
     return emit->value(u, v, p);
   }
 
+  bool is_emissive() const override { return true; }
+
 private:
   shared_ptr<texture> emit;
 };
@@ -130,6 +224,23 @@ public:
     return true;
   }
 
+  // 相位函数在整个球面上均匀，没有余弦项
+  bool sample(const ray& r_in, const hit_record& rec, bsdf_sample& s) const override {
+    s.direction = random_unit_vector();
+    s.weight = albedo->value(rec.u, rec.v, rec.p);
+    s.pdf = 1 / (4 * pi);
+    s.specular = false;
+    return true;
+  }
+
+  color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+    return albedo->value(rec.u, rec.v, rec.p) / (4 * pi);
+  }
+
+  double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+    return 1 / (4 * pi);
+  }
+
 private:
   shared_ptr<texture> albedo;
 };
@@ -6,6 +6,7 @@
 #include "common.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "material.h"
 
 class quad : public hittable {
 public:
@@ -16,6 +17,7 @@ public:
     normal = unit_vector(n); // 所在平面的法向量
     D = dot(normal, Q); // 平面到原点的距离D
     w = n / dot(n, n);
+    area = n.length();
 
     set_bounding_box();
   }
@@ -50,12 +52,33 @@ public:
     // Ray hits the 2D shape; set the rest of the hit record and return true.
     rec.t = t;
     rec.p = intersection;
-    rec.mat_ptr = mat;
+    rec.mat_ptr = mat.get();
     rec.set_face_normal(r, normal);
 
     return true;
   }
 
+  // 在面上均匀取点：面积上的密度 1/area 换算到立体角要乘 distance^2 / cos
+  double pdf_value(const point3& origin, const vec3& direction) const override {
+    hit_record rec;
+    if (!this->hit(ray(origin, direction, 0.0), interval(0.001, infinity), rec))
+      return 0;
+
+    auto distance_squared = rec.t * rec.t * direction.length_squared();
+    auto cosine = fabs(dot(direction, rec.normal) / direction.length());
+    return distance_squared / (cosine * area);
+  }
+
+  vec3 random(const point3& origin) const override {
+    auto p = Q + (random_double() * u) + (random_double() * v);
+    return p - origin;
+  }
+
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    if (mat->is_emissive())
+      lights.push_back(this);
+  }
+
   virtual bool is_interior(double a, double b, hit_record& rec) const {
     // Given the hit point in plane coordinates, return false if it is outside the
     // primitive, otherwise set the hit record UV coordinates and return true.
@@ -76,9 +99,11 @@ private:
   vec3 normal; // 平行四边形平面的法向量
   double D; // 平面到远点的(最近)距离
   vec3 w;
+  double area;
 };
 
-inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat)
+// 用六个 quad 拼成的长方体，box() 现在返回只做一次 slab 测试的 box_prim(box.h)，这里留作对照
+inline shared_ptr<hittable_list> box_quads(const point3& a, const point3& b, shared_ptr<material> mat)
 {
   // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
   // a、b为长方体对角线两点，由此生成6个面
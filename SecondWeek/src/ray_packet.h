@@ -0,0 +1,43 @@
+﻿#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "common.h"
+
+#include <cstdint>
+
+// 光线包：最多 16 条光线按 SoA 存放，一起遍历加速结构。
+// active 标记参与求交的光线，hit_mask 标记已经找到交点的光线；
+// tmax 随着找到更近的交点而缩小，和单条光线的 ray_t.max 作用相同。
+struct ray_packet {
+  static const int max_size = 16;
+
+  int size = 0;
+  uint32_t active = 0;
+  uint32_t hit_mask = 0;
+
+  double ox[max_size], oy[max_size], oz[max_size];
+  double dx[max_size], dy[max_size], dz[max_size];
+  double time[max_size];
+  double tmin[max_size], tmax[max_size];
+
+  void set(int i, const ray& r, interval ray_t) {
+    ox[i] = r.origin().x(); oy[i] = r.origin().y(); oz[i] = r.origin().z();
+    dx[i] = r.direction().x(); dy[i] = r.direction().y(); dz[i] = r.direction().z();
+    time[i] = r.time();
+    tmin[i] = ray_t.min;
+    tmax[i] = ray_t.max;
+    active |= 1u << i;
+  }
+
+  ray get(int i) const {
+    return ray(point3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]), time[i]);
+  }
+
+  void clear() {
+    size = 0;
+    active = 0;
+    hit_mask = 0;
+  }
+};
+
+#endif
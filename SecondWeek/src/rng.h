@@ -0,0 +1,95 @@
+﻿#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// PCG32 随机数生成器(pcg-random.org)：16 字节状态，比 mt19937 的 5KB 状态更适合放在每个线程里
+class pcg32 {
+public:
+  pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+
+  pcg32(uint64_t initstate, uint64_t initseq) { seed(initstate, initseq); }
+
+  void seed(uint64_t initstate, uint64_t initseq) {
+    state = 0u;
+    inc = (initseq << 1u) | 1u;
+    next_uint();
+    state += initstate;
+    next_uint();
+  }
+
+  uint32_t next_uint() {
+    uint64_t oldstate = state;
+    state = oldstate * 6364136223846793005ULL + inc;
+    auto xorshifted = static_cast<uint32_t>(((oldstate >> 18u) ^ oldstate) >> 27u);
+    auto rot = static_cast<uint32_t>(oldstate >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+  }
+
+  double next_double() {
+    // Returns a random real in [0,1).
+    return next_uint() * (1.0 / 4294967296.0);
+  }
+
+public:
+  uint64_t state;
+  uint64_t inc;
+};
+
+// splitmix64 的混合函数，把相邻的整数打散成互不相关的种子
+inline uint64_t mix_bits(uint64_t v) {
+  v ^= v >> 31;
+  v *= 0x7fb5d329728ea185ULL;
+  v ^= v >> 27;
+  v *= 0x81dadef4fc2e5d55ULL;
+  v ^= v >> 33;
+  return v;
+}
+
+class pixel_sampler;
+
+// 采样器维度的分配：相机光线 5 维(像素内位置 2、镜头 2、时间 1)，之后每次弹射 6 维
+// (材质采样方向 2、选择光源 1、光源上的点 2、俄罗斯轮盘赌 1)。超出一次弹射预算的随机数由 PCG32 提供
+const uint32_t camera_dimensions = 5;
+const uint32_t bounce_dimensions = 6;
+
+// 每个线程的随机数状态：当前所在的 (像素, 采样序号)、对应的生成器，以及正在使用的采样器维度
+struct rng_context {
+  uint64_t pixel = 0;
+  uint64_t sample = 0;
+  pcg32 generator;
+
+  const pixel_sampler* sampler = nullptr; // 为空时全部随机数来自 generator
+  uint32_t x = 0, y = 0;                  // 像素坐标，采样器做像素间去相关时使用
+  uint64_t pixel_key = 0;                 // 像素的哈希，采样器用来给每个像素不同的扰乱
+  uint32_t dimension = 0;                 // 下一个 random_double 使用的维度
+  uint32_t dimension_end = 0;             // 本次弹射可用的维度到此为止
+  uint32_t cached_dimension = ~0u;        // 二维槽的第二个分量和第一个一起算出，存在这里
+  double cached_value = 0;
+};
+
+inline rng_context& thread_rng() {
+  static thread_local rng_context context;
+  return context;
+}
+
+// 随机序列只由 (像素, 采样序号, 弹射次数) 决定，所以渲染结果与线程数、tile 的执行顺序无关
+inline void rng_start_bounce(uint64_t bounce) {
+  auto& ctx = thread_rng();
+  auto seed = mix_bits(ctx.pixel ^ mix_bits(ctx.sample ^ mix_bits(bounce)));
+  ctx.generator.seed(seed, ctx.pixel);
+
+  if (ctx.sampler) {
+    ctx.dimension = bounce == 0 ? 0 : camera_dimensions + static_cast<uint32_t>(bounce - 1) * bounce_dimensions;
+    ctx.dimension_end = ctx.dimension + (bounce == 0 ? camera_dimensions : bounce_dimensions);
+  }
+}
+
+inline void rng_start_sample(uint64_t pixel, uint64_t sample) {
+  auto& ctx = thread_rng();
+  ctx.pixel = pixel;
+  ctx.sample = sample;
+  rng_start_bounce(0);
+}
+
+#endif
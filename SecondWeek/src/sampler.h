@@ -0,0 +1,255 @@
+﻿#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rng.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// 像素采样器：给像素的第 s 个样本的每个维度一个 [0,1) 中的值(维度分配见 rng.h)。
+// 同一像素的各个样本在每个维度上均匀铺开，比独立随机数收敛得快；每个像素的序列独立随机化，结果仍然无偏。
+// 值只由 (像素, 样本序号, 维度) 决定，和 PCG32 一样与线程数、执行顺序无关
+enum class sampler_type {
+  independent, // 每个维度都用 PCG32，即原来的做法
+  stratified,  // 分层抖动：二维槽按网格分层，一维槽按区间分层，层的顺序随机打乱
+  halton,      // Halton 序列，每个维度一个素数底，每个像素做随机平移(Cranley-Patterson)
+  sobol        // Owen 扰乱的 Sobol 序列：每个二维槽用前两维并各自扰乱、打乱序号(Burley 2020)
+};
+
+class pixel_sampler {
+public:
+  pixel_sampler() {}
+
+  // samples_per_pixel 是分层采样的层数(超过时按同样的层数另起一轮)；dimensions 是 Halton 需要的素数个数。
+  // blue_noise 为 true 时所有像素共用同一个扰乱，再按 R2 序列平移，相邻像素的误差互相错开，噪声呈蓝噪声分布
+  pixel_sampler(sampler_type type, int samples_per_pixel, bool blue_noise, uint32_t dimensions)
+    : type(type), strata(std::max(1, samples_per_pixel)), blue_noise(blue_noise) {
+    grid_x = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(strata))));
+    grid_y = (strata + grid_x - 1) / grid_x;
+
+    if (type == sampler_type::halton) {
+      for (uint32_t n = 2; primes.size() < dimensions; ++n) {
+        bool prime = true;
+        for (auto p : primes) {
+          if (p * p > n) break;
+          if (n % p == 0) { prime = false; break; }
+        }
+        if (prime) primes.push_back(n);
+      }
+    }
+  }
+
+  bool independent() const { return type == sampler_type::independent; }
+
+  // 开始像素 (x, y) 的第 sample 个样本，之后的 random_double 先取本采样器的维度
+  void start(int x, int y, uint64_t pixel, uint64_t sample) const {
+    auto& ctx = thread_rng();
+    ctx.sampler = independent() ? nullptr : this;
+    ctx.x = static_cast<uint32_t>(x);
+    ctx.y = static_cast<uint32_t>(y);
+    ctx.pixel_key = blue_noise ? 0 : mix_bits(pixel + 1);
+    ctx.dimension = ctx.dimension_end = 0;
+    ctx.cached_dimension = ~0u;
+    rng_start_sample(pixel, sample);
+  }
+
+  // 渲染线程回到调用者(或去构建场景)之前解除采样器，之后的随机数全部来自 PCG32
+  static void finish() {
+    auto& ctx = thread_rng();
+    ctx.sampler = nullptr;
+    ctx.dimension = ctx.dimension_end = 0;
+  }
+
+  // 维度 dim 的值。二维槽的两个分量一起算出，第二个分量留在 ctx 中等下一次调用
+  double get(rng_context& ctx, uint32_t dim) const {
+    if (dim == ctx.cached_dimension)
+      return ctx.cached_value;
+
+    bool pair;
+    auto slot = slot_of(dim, pair);
+    auto key = mix_bits(slot ^ ctx.pixel_key);
+
+    double v[2];
+    switch (type) {
+    case sampler_type::stratified:
+      stratified(ctx.sample, key, pair, v);
+      break;
+    case sampler_type::halton:
+      v[0] = halton(ctx.sample, slot, key);
+      v[1] = pair ? halton(ctx.sample, slot + 1, key) : 0;
+      break;
+    default:
+      sobol(ctx.sample, key, v);
+      break;
+    }
+
+    if (pair) {
+      ctx.cached_dimension = slot + 1;
+      ctx.cached_value = decorrelate(ctx, slot + 1, v[1]);
+    }
+    return decorrelate(ctx, dim, v[dim - slot]);
+  }
+
+private:
+  sampler_type type = sampler_type::independent;
+  int strata = 1;
+  int grid_x = 1, grid_y = 1;
+  bool blue_noise = false;
+  std::vector<uint32_t> primes;
+
+  static constexpr double one_minus_epsilon = 0x1.fffffffffffffp-1;
+
+  static double to_unit(uint64_t bits) { return (bits >> 11) * 0x1p-53; }
+
+  double decorrelate(const rng_context& ctx, uint32_t dim, double v) const {
+    if (blue_noise) {
+      // R2 序列在像素平面上的抖动图，每一维再错开黄金分割
+      auto shift = 0.7548776662466927 * ctx.x + 0.5698402909980532 * ctx.y + 0.6180339887498949 * dim;
+      v += shift - std::floor(shift);
+      v -= std::floor(v);
+    }
+    return std::min(v, one_minus_epsilon);
+  }
+
+  // 维度 dim 所在的槽：二维槽的两个分量一起分层，返回槽的第一个维度。
+  // 相机：0-1 像素内位置、2-3 镜头、4 时间；每次弹射：0-1 材质、2 选择光源、3-4 光源上的点、5 俄罗斯轮盘赌
+  static uint32_t slot_of(uint32_t dim, bool& pair) {
+    uint32_t offset, base;
+    if (dim < camera_dimensions) {
+      offset = dim;
+      base = 0;
+      pair = offset < 4;
+    }
+    else {
+      offset = (dim - camera_dimensions) % bounce_dimensions;
+      base = dim - offset;
+      pair = offset <= 1 || offset == 3 || offset == 4;
+      if (offset >= 3) {
+        base += 3;
+        offset -= 3;
+      }
+    }
+
+    return base + (pair ? offset & ~1u : offset);
+  }
+
+  // Kensler 的无状态随机置换：把 i 映射到 [0, l) 中的另一个位置，p 不同置换不同
+  static uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+      i ^= p;
+      i *= 0xe170893d;
+      i ^= p >> 16;
+      i ^= (i & w) >> 4;
+      i ^= p >> 8;
+      i *= 0x0929eb3f;
+      i ^= p >> 23;
+      i ^= (i & w) >> 1;
+      i *= 1 | p >> 27;
+      i *= 0x6935fa69;
+      i ^= (i & w) >> 11;
+      i *= 0x74dcb303;
+      i ^= (i & w) >> 2;
+      i *= 0x9e501cc3;
+      i ^= (i & w) >> 2;
+      i *= 0xc860a3df;
+      i &= w;
+      i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+  }
+
+  // 每 strata 个样本为一轮，一轮内每层恰好一个样本；层数凑不成整网格时随机空出几格，每个样本仍然均匀
+  void stratified(uint64_t sample, uint64_t key, bool pair, double v[2]) const {
+    auto k = static_cast<uint32_t>(sample % strata);
+    auto pass_key = mix_bits(key ^ (sample / strata));
+    auto jitter = mix_bits(pass_key ^ k);
+
+    if (!pair) {
+      v[0] = (permute(k, strata, static_cast<uint32_t>(pass_key)) + to_unit(jitter)) / strata;
+      return;
+    }
+
+    auto cell = permute(k, static_cast<uint32_t>(grid_x * grid_y), static_cast<uint32_t>(pass_key));
+    v[0] = (cell % grid_x + to_unit(jitter)) / grid_x;
+    v[1] = (cell / grid_x + to_unit(mix_bits(jitter))) / grid_y;
+  }
+
+  double halton(uint64_t sample, uint32_t dim, uint64_t key) const {
+    auto shift = to_unit(mix_bits(key ^ dim));
+    if (dim >= primes.size())
+      return to_unit(mix_bits(key ^ mix_bits(sample + 1)));
+
+    // 先按整数求出反转后的各位数字，最后只做一次除法
+    uint32_t base = primes[dim];
+    uint64_t reversed = 0;
+    double scale = 1;
+    for (auto a = static_cast<uint32_t>(sample + 1); a > 0; a /= base) {
+      reversed = reversed * base + a % base;
+      scale /= base;
+    }
+    auto v = reversed * scale + shift;
+    return v - std::floor(v);
+  }
+
+  static uint32_t reverse_bits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+  }
+
+  // Laine-Karras 哈希：每一位只受更低位影响
+  static uint32_t laine_karras(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+  }
+
+  // 在位反转后的值上做 Laine-Karras 哈希即 Owen 扰乱：高位决定低位的翻转，保持 (0, m, 2) 网格的分层
+  static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras(reverse_bits(x), seed));
+  }
+
+  // Sobol 序列的第二维，方向数满足 v[k] = v[k-1] ^ (v[k-1] >> 1)。
+  // 打乱后的序号占满 32 位，所以按字节查表，每个字节一次异或
+  static uint32_t sobol_second(uint32_t index) {
+    static const std::vector<uint32_t> table = [] {
+      std::vector<uint32_t> t(4 * 256, 0);
+      uint32_t columns[32];
+      columns[0] = 1u << 31;
+      for (int k = 1; k < 32; ++k)
+        columns[k] = columns[k - 1] ^ (columns[k - 1] >> 1);
+      for (int b = 0; b < 4; ++b)
+        for (int bits = 0; bits < 256; ++bits)
+          for (int k = 0; k < 8; ++k)
+            if (bits & (1 << k))
+              t[b * 256 + bits] ^= columns[8 * b + k];
+      return t;
+    }();
+
+    return table[index & 0xff] ^ table[256 + ((index >> 8) & 0xff)]
+         ^ table[512 + ((index >> 16) & 0xff)] ^ table[768 + (index >> 24)];
+  }
+
+  // 第一维是序号的位反转，扰乱时两次反转抵消
+  void sobol(uint64_t sample, uint64_t key, double v[2]) const {
+    auto index = nested_uniform_scramble(static_cast<uint32_t>(sample), static_cast<uint32_t>(key));
+    auto seeds = mix_bits(key);
+    v[0] = reverse_bits(laine_karras(index, static_cast<uint32_t>(seeds))) * 0x1p-32;
+    v[1] = nested_uniform_scramble(sobol_second(index), static_cast<uint32_t>(seeds >> 32)) * 0x1p-32;
+  }
+};
+
+#endif
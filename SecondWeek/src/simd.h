@@ -0,0 +1,63 @@
+﻿#ifndef SIMD_H
+#define SIMD_H
+
+// SIMD 相关的编译开关与运行时 CPU 检测。
+// x86/x64 上 SSE2 是基线指令集可以直接使用；AVX2 代码按函数单独开启，运行时确认 CPU 支持后才调用。
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RT_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define RT_SIMD_X86 0
+#endif
+
+// MSVC 不需要为单个函数开启指令集；GCC/Clang 需要用 target 属性编译 AVX2 函数。
+// 不开 fma：运行时只检测 AVX2，而且开了以后编译器会在不同函数里把乘加融合成不同的结果
+#if RT_SIMD_X86 && (defined(__GNUC__) || defined(__clang__))
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RT_TARGET_AVX2
+#endif
+
+// 可用的盒子求交内核
+enum class simd_level {
+  scalar,
+  sse,
+  avx2
+};
+
+inline bool cpu_supports_avx2() {
+#if RT_SIMD_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx) return false;
+  if ((_xgetbv(0) & 0x6) != 0x6) return false; // 操作系统需保存 YMM 寄存器
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+#else
+  return false;
+#endif
+}
+
+// 本机可用的最高一级 SIMD，只检测一次
+inline simd_level detect_simd_level() {
+  static const simd_level level = [] {
+    if (cpu_supports_avx2()) return simd_level::avx2;
+    return RT_SIMD_X86 ? simd_level::sse : simd_level::scalar;
+  }();
+  return level;
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include "hittable.h"
+#include "material.h"
+#include "onb.h"
 
 class sphere : public hittable {
 public:
@@ -26,6 +28,69 @@ public:
 
   aabb bounding_box() const override { return bbox; } // 构造时已生成bbx
 
+  // 两个根之间就是球内，不用求交点的法线和 uv
+  void hit_intervals(const ray& r, span_list& spans) const override {
+    point3 center = is_moving ? sphere_center(r.time()) : center1;
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius * radius;
+    auto discriminant = half_b * half_b - a * c;
+    if (discriminant <= 0)
+      return;
+
+    auto sqrtd = sqrt(discriminant);
+    spans.add(interval((-half_b - sqrtd) / a, (-half_b + sqrtd) / a));
+  }
+
+  // 把球(时间 0 时的球心)移到 center，移动的球保持原来的运动向量。之后要 refit 包含它的 BVH
+  void move_to(const point3& center) {
+    center1 = center;
+    auto rvec = vec3(radius, radius, radius);
+    bbox = aabb(center1 - rvec, center1 + rvec);
+    if (is_moving)
+      bbox = aabb(bbox, aabb(center1 + center_vec - rvec, center1 + center_vec + rvec));
+  }
+
+  // 球心匀速移动，任意时刻的包围盒正好是两端包围盒的线性插值
+  void motion_bounds(aabb& start, aabb& end) const override {
+    auto rvec = vec3(radius, radius, radius);
+    auto center2 = center1 + center_vec;
+    start = is_moving ? aabb(center1 - rvec, center1 + rvec) : bbox;
+    end = is_moving ? aabb(center2 - rvec, center2 + rvec) : bbox;
+  }
+
+  // 在 origin 看到的球面圆锥内均匀采样方向；origin 在球内时改为在整个单位球面上均匀采样
+  double pdf_value(const point3& origin, const vec3& direction) const override {
+    hit_record rec;
+    if (!this->hit(ray(origin, direction, 0.0), interval(0.001, infinity), rec))
+      return 0;
+
+    auto distance_squared = (center1 - origin).length_squared();
+    if (distance_squared <= radius * radius)
+      return 1 / (4 * pi);
+
+    auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    auto solid_angle = 2 * pi * (1 - cos_theta_max);
+    return 1 / solid_angle;
+  }
+
+  vec3 random(const point3& origin) const override {
+    vec3 direction = center1 - origin;
+    auto distance_squared = direction.length_squared();
+    if (distance_squared <= radius * radius)
+      return random_unit_vector();
+
+    onb uvw(direction);
+    return uvw.transform(random_to_sphere(radius, distance_squared));
+  }
+
+  // 移动的球无法按固定的球心采样，不作为光源
+  void gather_lights(std::vector<const hittable*>& lights) const override {
+    if (!is_moving && mat_ptr->is_emissive())
+      lights.push_back(this);
+  }
+
 public:
   point3 center1;
   double radius;
@@ -40,7 +105,19 @@ public:
     return center1 + time * center_vec;
   }
 
-private:
+  // 以 +z 为轴、张角 cos_theta_max 的圆锥内均匀分布的方向
+  static vec3 random_to_sphere(double radius, double distance_squared) {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    auto z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
+
+    auto phi = 2 * pi * r1;
+    auto x = cos(phi) * sqrt(1 - z * z);
+    auto y = sin(phi) * sqrt(1 - z * z);
+
+    return vec3(x, y, z);
+  }
+
   // 根据球上一点获得对应的uv（0-1）位置
   static void get_sphere_uv(const point3& p, double& u, double& v) {
     // p: a given point on the sphere of radius one, centered at the origin.
@@ -80,7 +157,7 @@ bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
   vec3 outward_normal = (rec.p - center) / radius;
   rec.set_face_normal(r, outward_normal);
   get_sphere_uv(outward_normal, rec.u, rec.v); // outward_normal 其实也对应球(model坐标系)上一点坐标
-  rec.mat_ptr = mat_ptr;
+  rec.mat_ptr = mat_ptr.get();
 
   return true;
 }
@@ -0,0 +1,456 @@
+﻿#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "common.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+// 一组球按 SoA 存放：球心、运动向量、半径各占一段连续的 double，材质只存编号。
+// 求交时 AVX2 一次算 4 个球(SSE2 一次 2 个)，可以作为 BVH 的多物体叶子使用。
+// 静止的球运动向量为 0，和移动的球走同一个内核。
+class sphere_set : public hittable {
+public:
+  sphere_set(const hittable_list& list, simd_level level = detect_simd_level())
+    : sphere_set(list.objects, level) {}
+
+  // objects 中的物体必须都是 sphere，先用 can_hold 检查
+  sphere_set(const std::vector<shared_ptr<hittable>>& objects, simd_level level = detect_simd_level())
+    : level(level) {
+    build(objects);
+  }
+
+  // 发光的球要作为单独的光源被采样，不放进 sphere_set
+  static bool can_hold(const hittable& object) {
+    auto s = dynamic_cast<const sphere*>(&object);
+    return s != nullptr && !s->mat_ptr->is_emissive();
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    int index = closest(r, ray_t);
+    if (index < 0)
+      return false;
+
+    fill_record(r, index, ray_t.max, rec);
+    return true;
+  }
+
+  // 光线包求交：逐个球，一次测试包内 4 条(AVX2)或 2 条(SSE2)光线，不在 packet.active 中的光线不更新。
+  // 每条光线按球的顺序依次比较，结果和逐条调用 hit 完全相同
+  void hit_packet(ray_packet& packet, hit_record* rec) const override {
+    if (packet.active == 0)
+      return;
+
+    int best[ray_packet::max_size];
+    for (int i = 0; i < ray_packet::max_size; ++i)
+      best[i] = -1;
+
+#if RT_SIMD_X86
+    if (level == simd_level::avx2)
+      closest_packet_avx2(packet, best);
+    else if (level == simd_level::sse)
+      closest_packet_sse(packet, best);
+    else
+#endif
+      closest_packet_scalar(packet, best);
+
+    for (uint32_t m = packet.active; m; m &= m - 1) {
+      int i = lowest_set_bit(m);
+      if (best[i] < 0)
+        continue;
+      fill_record(packet.get(i), best[i], packet.tmax[i], rec[i]);
+      packet.hit_mask |= 1u << i;
+    }
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  // 球移动后重新读取球心、运动向量和半径
+  void refit() override { load_geometry(); }
+
+  size_t size() const { return count; }
+
+private:
+  enum soa_field { center_x, center_y, center_z, motion_x, motion_y, motion_z, radius, field_count };
+
+  size_t count = 0;
+  size_t capacity = 0;     // count 向上取整到 4 的倍数，多出的位置球心为 NaN，永远不会命中
+  std::vector<double> soa; // field_count 段，每段 capacity 个
+  std::vector<int32_t> material_id;
+  std::vector<shared_ptr<material>> materials; // 去重后的材质表
+  std::vector<shared_ptr<const sphere>> sources; // 原来的球，refit 时从这里重新读取
+  aabb bbox;
+  simd_level level;
+
+  const double* field(soa_field f) const { return soa.data() + f * capacity; }
+
+  // 只为最近的球计算交点信息，和 sphere::hit 相同
+  void fill_record(const ray& r, int index, double t, hit_record& rec) const {
+    auto time = r.time();
+    point3 center(field(center_x)[index] + time * field(motion_x)[index],
+                  field(center_y)[index] + time * field(motion_y)[index],
+                  field(center_z)[index] + time * field(motion_z)[index]);
+
+    rec.t = t;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / field(radius)[index];
+    rec.set_face_normal(r, outward_normal);
+    sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat_ptr = materials[material_id[index]].get();
+  }
+
+  void build(const std::vector<shared_ptr<hittable>>& objects) {
+    count = objects.size();
+    capacity = (count + 3) / 4 * 4;
+
+    soa.assign(field_count * capacity, 0.0);
+    auto nan = std::numeric_limits<double>::quiet_NaN();
+    for (size_t i = count; i < capacity; ++i)
+      soa[center_x * capacity + i] = soa[center_y * capacity + i] = soa[center_z * capacity + i] = nan;
+
+    std::unordered_map<const material*, int32_t> material_index;
+    material_id.resize(count);
+    sources.resize(count);
+
+    for (size_t i = 0; i < count; ++i) {
+      sources[i] = std::static_pointer_cast<const sphere>(objects[i]);
+      const auto& s = *sources[i];
+      auto found = material_index.find(s.mat_ptr.get());
+      if (found == material_index.end()) {
+        found = material_index.emplace(s.mat_ptr.get(), static_cast<int32_t>(materials.size())).first;
+        materials.push_back(s.mat_ptr);
+      }
+      material_id[i] = found->second;
+    }
+
+    load_geometry();
+  }
+
+  void load_geometry() {
+    bbox = aabb();
+    for (size_t i = 0; i < count; ++i) {
+      const auto& s = *sources[i];
+      soa[center_x * capacity + i] = s.center1.x();
+      soa[center_y * capacity + i] = s.center1.y();
+      soa[center_z * capacity + i] = s.center1.z();
+      soa[motion_x * capacity + i] = s.is_moving ? s.center_vec.x() : 0;
+      soa[motion_y * capacity + i] = s.is_moving ? s.center_vec.y() : 0;
+      soa[motion_z * capacity + i] = s.is_moving ? s.center_vec.z() : 0;
+      soa[radius * capacity + i] = s.radius;
+      bbox = aabb(bbox, s.bounding_box());
+    }
+  }
+
+  // 返回最近一个交点所在球的下标(没有则为 -1)，ray_t.max 缩小为该交点的 t
+  int closest(const ray& r, interval& ray_t) const {
+#if RT_SIMD_X86
+    if (level == simd_level::avx2)
+      return closest_avx2(r, ray_t);
+    if (level == simd_level::sse)
+      return closest_sse(r, ray_t);
+#endif
+    return closest_scalar(r, ray_t);
+  }
+
+  int closest_scalar(const ray& r, interval& ray_t) const {
+    const double* cx = field(center_x);
+    const double* cy = field(center_y);
+    const double* cz = field(center_z);
+    const double* mx = field(motion_x);
+    const double* my = field(motion_y);
+    const double* mz = field(motion_z);
+    const double* rad = field(radius);
+
+    const auto orig = r.origin();
+    const auto dir = r.direction();
+    const auto time = r.time();
+    const auto a = dir.length_squared();
+
+    int best = -1;
+    for (size_t i = 0; i < count; ++i) {
+      vec3 oc = orig - point3(cx[i] + time * mx[i], cy[i] + time * my[i], cz[i] + time * mz[i]);
+      auto half_b = dot(oc, dir);
+      auto c = oc.length_squared() - rad[i] * rad[i];
+      auto discriminant = half_b * half_b - a * c;
+      if (discriminant < 0)
+        continue;
+
+      auto sqrtd = sqrt(discriminant);
+      auto root = (-half_b - sqrtd) / a;
+      if (!ray_t.surrounds(root)) {
+        root = (-half_b + sqrtd) / a;
+        if (!ray_t.surrounds(root))
+          continue;
+      }
+      ray_t.max = root;
+      best = static_cast<int>(i);
+    }
+    return best;
+  }
+
+  void closest_packet_scalar(ray_packet& packet, int* best) const {
+    for (uint32_t m = packet.active; m; m &= m - 1) {
+      int i = lowest_set_bit(m);
+      interval ray_t(packet.tmin[i], packet.tmax[i]);
+      best[i] = closest_scalar(packet.get(i), ray_t);
+      packet.tmax[i] = ray_t.max;
+    }
+  }
+
+#if RT_SIMD_X86
+  // 每次 2 个球；两个根都算出来，再按 sphere::hit 的规则选择：近根在区间内取近根，否则取远根。
+  // 判别式为负时 sqrt 得到 NaN，和 NaN 的比较都为假，这些球自然被排除。
+  int closest_sse(const ray& r, interval& ray_t) const {
+    const double* cx = field(center_x);
+    const double* cy = field(center_y);
+    const double* cz = field(center_z);
+    const double* mx = field(motion_x);
+    const double* my = field(motion_y);
+    const double* mz = field(motion_z);
+    const double* rad = field(radius);
+
+    const auto orig = r.origin();
+    const auto dir = r.direction();
+    const __m128d ox = _mm_set1_pd(orig.x()), oy = _mm_set1_pd(orig.y()), oz = _mm_set1_pd(orig.z());
+    const __m128d dx = _mm_set1_pd(dir.x()), dy = _mm_set1_pd(dir.y()), dz = _mm_set1_pd(dir.z());
+    const __m128d time = _mm_set1_pd(r.time());
+    const __m128d a = _mm_set1_pd(dir.length_squared());
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d tmin = _mm_set1_pd(ray_t.min);
+
+    int best = -1;
+    alignas(16) double roots[2];
+
+    for (size_t i = 0; i < capacity; i += 2) {
+      __m128d ocx = _mm_sub_pd(ox, _mm_add_pd(_mm_loadu_pd(cx + i), _mm_mul_pd(time, _mm_loadu_pd(mx + i))));
+      __m128d ocy = _mm_sub_pd(oy, _mm_add_pd(_mm_loadu_pd(cy + i), _mm_mul_pd(time, _mm_loadu_pd(my + i))));
+      __m128d ocz = _mm_sub_pd(oz, _mm_add_pd(_mm_loadu_pd(cz + i), _mm_mul_pd(time, _mm_loadu_pd(mz + i))));
+      __m128d rr = _mm_loadu_pd(rad + i);
+
+      __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+      __m128d oc2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz));
+      __m128d c = _mm_sub_pd(oc2, _mm_mul_pd(rr, rr));
+      __m128d sqrtd = _mm_sqrt_pd(_mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c)));
+
+      __m128d neg_b = _mm_xor_pd(half_b, sign);
+      __m128d near_root = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), a);
+      __m128d far_root = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), a);
+
+      __m128d tmax = _mm_set1_pd(ray_t.max);
+      __m128d near_ok = _mm_and_pd(_mm_cmpgt_pd(near_root, tmin), _mm_cmplt_pd(near_root, tmax));
+      __m128d far_ok = _mm_and_pd(_mm_cmpgt_pd(far_root, tmin), _mm_cmplt_pd(far_root, tmax));
+
+      int mask = _mm_movemask_pd(_mm_or_pd(near_ok, far_ok));
+      if (!mask)
+        continue;
+
+      _mm_store_pd(roots, _mm_or_pd(_mm_and_pd(near_ok, near_root), _mm_andnot_pd(near_ok, far_root)));
+      best = pick_closest(mask, roots, i, ray_t, best);
+    }
+    return best;
+  }
+
+  // 每次 4 个球，逻辑同 closest_sse
+  RT_TARGET_AVX2
+  int closest_avx2(const ray& r, interval& ray_t) const {
+    const double* cx = field(center_x);
+    const double* cy = field(center_y);
+    const double* cz = field(center_z);
+    const double* mx = field(motion_x);
+    const double* my = field(motion_y);
+    const double* mz = field(motion_z);
+    const double* rad = field(radius);
+
+    const auto orig = r.origin();
+    const auto dir = r.direction();
+    const __m256d ox = _mm256_set1_pd(orig.x()), oy = _mm256_set1_pd(orig.y()), oz = _mm256_set1_pd(orig.z());
+    const __m256d dx = _mm256_set1_pd(dir.x()), dy = _mm256_set1_pd(dir.y()), dz = _mm256_set1_pd(dir.z());
+    const __m256d time = _mm256_set1_pd(r.time());
+    const __m256d a = _mm256_set1_pd(dir.length_squared());
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d tmin = _mm256_set1_pd(ray_t.min);
+
+    int best = -1;
+    alignas(32) double roots[4];
+
+    for (size_t i = 0; i < capacity; i += 4) {
+      __m256d ocx = _mm256_sub_pd(ox, _mm256_add_pd(_mm256_loadu_pd(cx + i), _mm256_mul_pd(time, _mm256_loadu_pd(mx + i))));
+      __m256d ocy = _mm256_sub_pd(oy, _mm256_add_pd(_mm256_loadu_pd(cy + i), _mm256_mul_pd(time, _mm256_loadu_pd(my + i))));
+      __m256d ocz = _mm256_sub_pd(oz, _mm256_add_pd(_mm256_loadu_pd(cz + i), _mm256_mul_pd(time, _mm256_loadu_pd(mz + i))));
+      __m256d rr = _mm256_loadu_pd(rad + i);
+
+      __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+      __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+      __m256d c = _mm256_sub_pd(oc2, _mm256_mul_pd(rr, rr));
+      __m256d sqrtd = _mm256_sqrt_pd(_mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c)));
+
+      __m256d neg_b = _mm256_xor_pd(half_b, sign);
+      __m256d near_root = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+      __m256d far_root = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+
+      __m256d tmax = _mm256_set1_pd(ray_t.max);
+      __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(near_root, tmin, _CMP_GT_OQ), _mm256_cmp_pd(near_root, tmax, _CMP_LT_OQ));
+      __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(far_root, tmin, _CMP_GT_OQ), _mm256_cmp_pd(far_root, tmax, _CMP_LT_OQ));
+
+      int mask = _mm256_movemask_pd(_mm256_or_pd(near_ok, far_ok));
+      if (!mask)
+        continue;
+
+      _mm256_store_pd(roots, _mm256_blendv_pd(far_root, near_root, near_ok));
+      best = pick_closest(mask, roots, i, ray_t, best);
+    }
+    return best;
+  }
+#endif
+
+#if RT_SIMD_X86
+  // 包内每 2 条光线一组，依次和每个球求交；算式和 closest_scalar 逐项相同，所以 t 逐位一致。
+  // 不活跃的光线也参与计算(包里的值可能是上一次留下的)，但结果被 lanes 屏蔽
+  void closest_packet_sse(ray_packet& packet, int* best) const {
+    const double* cx = field(center_x);
+    const double* cy = field(center_y);
+    const double* cz = field(center_z);
+    const double* mx = field(motion_x);
+    const double* my = field(motion_y);
+    const double* mz = field(motion_z);
+    const double* rad = field(radius);
+    const __m128d sign = _mm_set1_pd(-0.0);
+
+    for (int g = 0; g < packet.size; g += 2) {
+      int lanes = (packet.active >> g) & 0x3;
+      if (!lanes)
+        continue;
+      const __m128d lane_mask = _mm_castsi128_pd(_mm_set_epi64x(-static_cast<int64_t>((lanes >> 1) & 1),
+                                                                -static_cast<int64_t>(lanes & 1)));
+
+      const __m128d ox = _mm_loadu_pd(packet.ox + g), oy = _mm_loadu_pd(packet.oy + g), oz = _mm_loadu_pd(packet.oz + g);
+      const __m128d dx = _mm_loadu_pd(packet.dx + g), dy = _mm_loadu_pd(packet.dy + g), dz = _mm_loadu_pd(packet.dz + g);
+      const __m128d time = _mm_loadu_pd(packet.time + g);
+      const __m128d a = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+      const __m128d tmin = _mm_loadu_pd(packet.tmin + g);
+      __m128d tmax = _mm_loadu_pd(packet.tmax + g);
+
+      for (size_t i = 0; i < count; ++i) {
+        __m128d ocx = _mm_sub_pd(ox, _mm_add_pd(_mm_set1_pd(cx[i]), _mm_mul_pd(time, _mm_set1_pd(mx[i]))));
+        __m128d ocy = _mm_sub_pd(oy, _mm_add_pd(_mm_set1_pd(cy[i]), _mm_mul_pd(time, _mm_set1_pd(my[i]))));
+        __m128d ocz = _mm_sub_pd(oz, _mm_add_pd(_mm_set1_pd(cz[i]), _mm_mul_pd(time, _mm_set1_pd(mz[i]))));
+        __m128d rr = _mm_set1_pd(rad[i]);
+
+        __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+        __m128d oc2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz));
+        __m128d c = _mm_sub_pd(oc2, _mm_mul_pd(rr, rr));
+        __m128d sqrtd = _mm_sqrt_pd(_mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c)));
+
+        __m128d neg_b = _mm_xor_pd(half_b, sign);
+        __m128d near_root = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), a);
+        __m128d far_root = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), a);
+
+        __m128d near_ok = _mm_and_pd(_mm_cmpgt_pd(near_root, tmin), _mm_cmplt_pd(near_root, tmax));
+        __m128d far_ok = _mm_and_pd(_mm_cmpgt_pd(far_root, tmin), _mm_cmplt_pd(far_root, tmax));
+        __m128d ok = _mm_and_pd(_mm_or_pd(near_ok, far_ok), lane_mask);
+
+        int mask = _mm_movemask_pd(ok);
+        if (!mask)
+          continue;
+
+        __m128d root = _mm_or_pd(_mm_and_pd(near_ok, near_root), _mm_andnot_pd(near_ok, far_root));
+        tmax = _mm_or_pd(_mm_and_pd(ok, root), _mm_andnot_pd(ok, tmax));
+        for (int k = 0; k < 2; ++k)
+          if (mask & (1 << k))
+            best[g + k] = static_cast<int>(i);
+      }
+
+      alignas(16) double result[2];
+      _mm_store_pd(result, tmax);
+      for (int k = 0; k < 2; ++k)
+        if (lanes & (1 << k))
+          packet.tmax[g + k] = result[k];
+    }
+  }
+
+  // 每 4 条光线一组，逻辑同 closest_packet_sse
+  RT_TARGET_AVX2
+  void closest_packet_avx2(ray_packet& packet, int* best) const {
+    const double* cx = field(center_x);
+    const double* cy = field(center_y);
+    const double* cz = field(center_z);
+    const double* mx = field(motion_x);
+    const double* my = field(motion_y);
+    const double* mz = field(motion_z);
+    const double* rad = field(radius);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+
+    for (int g = 0; g < packet.size; g += 4) {
+      int lanes = (packet.active >> g) & 0xf;
+      if (!lanes)
+        continue;
+      const __m256d lane_mask = _mm256_castsi256_pd(_mm256_set_epi64x(
+        -static_cast<int64_t>((lanes >> 3) & 1), -static_cast<int64_t>((lanes >> 2) & 1),
+        -static_cast<int64_t>((lanes >> 1) & 1), -static_cast<int64_t>(lanes & 1)));
+
+      const __m256d ox = _mm256_loadu_pd(packet.ox + g), oy = _mm256_loadu_pd(packet.oy + g), oz = _mm256_loadu_pd(packet.oz + g);
+      const __m256d dx = _mm256_loadu_pd(packet.dx + g), dy = _mm256_loadu_pd(packet.dy + g), dz = _mm256_loadu_pd(packet.dz + g);
+      const __m256d time = _mm256_loadu_pd(packet.time + g);
+      const __m256d a = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+      const __m256d tmin = _mm256_loadu_pd(packet.tmin + g);
+      __m256d tmax = _mm256_loadu_pd(packet.tmax + g);
+
+      for (size_t i = 0; i < count; ++i) {
+        __m256d ocx = _mm256_sub_pd(ox, _mm256_add_pd(_mm256_set1_pd(cx[i]), _mm256_mul_pd(time, _mm256_set1_pd(mx[i]))));
+        __m256d ocy = _mm256_sub_pd(oy, _mm256_add_pd(_mm256_set1_pd(cy[i]), _mm256_mul_pd(time, _mm256_set1_pd(my[i]))));
+        __m256d ocz = _mm256_sub_pd(oz, _mm256_add_pd(_mm256_set1_pd(cz[i]), _mm256_mul_pd(time, _mm256_set1_pd(mz[i]))));
+        __m256d rr = _mm256_set1_pd(rad[i]);
+
+        __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+        __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+        __m256d c = _mm256_sub_pd(oc2, _mm256_mul_pd(rr, rr));
+        __m256d sqrtd = _mm256_sqrt_pd(_mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c)));
+
+        __m256d neg_b = _mm256_xor_pd(half_b, sign);
+        __m256d near_root = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+        __m256d far_root = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+
+        __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(near_root, tmin, _CMP_GT_OQ), _mm256_cmp_pd(near_root, tmax, _CMP_LT_OQ));
+        __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(far_root, tmin, _CMP_GT_OQ), _mm256_cmp_pd(far_root, tmax, _CMP_LT_OQ));
+        __m256d ok = _mm256_and_pd(_mm256_or_pd(near_ok, far_ok), lane_mask);
+
+        int mask = _mm256_movemask_pd(ok);
+        if (!mask)
+          continue;
+
+        tmax = _mm256_blendv_pd(tmax, _mm256_blendv_pd(far_root, near_root, near_ok), ok);
+        for (int k = 0; k < 4; ++k)
+          if (mask & (1 << k))
+            best[g + k] = static_cast<int>(i);
+      }
+
+      alignas(32) double result[4];
+      _mm256_store_pd(result, tmax);
+      for (int k = 0; k < 4; ++k)
+        if (lanes & (1 << k))
+          packet.tmax[g + k] = result[k];
+    }
+  }
+#endif
+
+  // 在一组命中的球里挑最近的；t 相同时保留下标小的，和逐个调用 sphere::hit 的结果一致
+  static int pick_closest(int mask, const double* roots, size_t base, interval& ray_t, int best) {
+    for (int k = 0; mask; ++k, mask >>= 1) {
+      if ((mask & 1) && roots[k] < ray_t.max) {
+        ray_t.max = roots[k];
+        best = static_cast<int>(base + k);
+      }
+    }
+    return best;
+  }
+};
+
+#endif
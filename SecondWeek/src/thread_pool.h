@@ -0,0 +1,182 @@
+﻿#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 工作窃取(work stealing)线程池：每个工作线程有自己的任务队列，
+// 自己从队尾取任务(LIFO，缓存友好)，空闲时从其他线程的队头偷任务(FIFO)。
+class thread_pool {
+public:
+  using task = std::function<void()>;
+
+  // threads: 参与计算的线程总数(包含调用 wait 的线程)，<= 0 表示使用全部硬件线程
+  explicit thread_pool(int threads = 0) {
+    int n = (threads > 0) ? threads : default_thread_count();
+    // 调用 wait 的线程也会执行任务，所以只需创建 n-1 个工作线程
+    queues.resize(n);
+    for (auto& q : queues) q = std::make_unique<task_queue>();
+    for (int i = 1; i < n; ++i)
+      workers.emplace_back([this, i] { worker_loop(i); });
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+    sleep_cv.notify_all();
+    for (auto& t : workers) t.join();
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  int size() const { return static_cast<int>(queues.size()); }
+
+  static int default_thread_count() {
+    auto n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : static_cast<int>(n);
+  }
+
+  // 进程内共享的线程池，供 BVH 构建等不需要单独配置线程数的地方使用
+  static thread_pool& shared() {
+    static thread_pool pool;
+    return pool;
+  }
+
+  // 提交任务：工作线程内提交的任务放入自己的队列，外部提交的任务轮流分配到各队列
+  void submit(task t) {
+    int index = current_index();
+    if (index < 0)
+      index = static_cast<int>(next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size());
+
+    {
+      std::lock_guard<std::mutex> lock(queues[index]->mutex);
+      queues[index]->tasks.push_back(std::move(t));
+    }
+    pending.fetch_add(1, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    sleep_cv.notify_one();
+  }
+
+  // 执行一个任务(优先自己的队列，然后窃取)，没有可执行的任务时返回 false
+  bool run_one(int self) {
+    task t;
+    if (!pop_local(self, t) && !steal(self, t))
+      return false;
+    pending.fetch_sub(1, std::memory_order_acq_rel);
+    t();
+    return true;
+  }
+
+  // 调用线程在 thread_pool 中的队列编号：工作线程返回自己的编号，外部线程使用 0 号队列
+  int current_index() const {
+    return (tls_pool() == this) ? tls_index() : -1;
+  }
+
+  int helper_index() const {
+    int index = current_index();
+    return index < 0 ? 0 : index;
+  }
+
+private:
+  struct task_queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  std::vector<std::unique_ptr<task_queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<int> pending{ 0 };
+  std::atomic<unsigned> next_queue{ 0 };
+
+  std::mutex sleep_mutex;
+  std::condition_variable sleep_cv;
+  bool stopping = false;
+
+  static const thread_pool*& tls_pool() {
+    static thread_local const thread_pool* pool = nullptr;
+    return pool;
+  }
+
+  static int& tls_index() {
+    static thread_local int index = -1;
+    return index;
+  }
+
+  bool pop_local(int self, task& t) {
+    auto& q = *queues[self];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    t = std::move(q.tasks.back());
+    q.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(int self, task& t) {
+    int n = size();
+    for (int k = 1; k < n; ++k) {
+      auto& q = *queues[(self + k) % n];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty()) continue;
+      t = std::move(q.tasks.front());
+      q.tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  void worker_loop(int self) {
+    tls_pool() = this;
+    tls_index() = self;
+
+    while (true) {
+      if (run_one(self))
+        continue;
+
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      sleep_cv.wait(lock, [this] { return stopping || pending.load(std::memory_order_acquire) > 0; });
+      if (stopping && pending.load(std::memory_order_acquire) == 0)
+        return;
+    }
+  }
+};
+
+// 一组任务：run 提交任务，wait 在等待期间帮忙执行池中的任务，直到本组任务全部完成。
+// 任务内部可以再创建 task_group 递归地拆分任务。
+class task_group {
+public:
+  explicit task_group(thread_pool& p) : pool(p) {}
+
+  ~task_group() { wait(); }
+
+  void run(thread_pool::task t) {
+    remaining.fetch_add(1, std::memory_order_relaxed);
+    pool.submit([this, t = std::move(t)] {
+      t();
+      remaining.fetch_sub(1, std::memory_order_acq_rel);
+    });
+  }
+
+  void wait() {
+    int self = pool.helper_index();
+    while (remaining.load(std::memory_order_acquire) > 0) {
+      if (!pool.run_one(self))
+        std::this_thread::yield();
+    }
+  }
+
+private:
+  thread_pool& pool;
+  std::atomic<int> remaining{ 0 };
+};
+
+#endif
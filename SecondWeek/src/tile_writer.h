@@ -0,0 +1,183 @@
+﻿#ifndef TILE_WRITER_H
+#define TILE_WRITER_H
+
+#include "framebuffer.h"
+#include "image_output.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 流式输出：渲染线程把完成的 tile 放进队列后立即返回，后台 I/O 线程按位置把它写进 PPM 或 PFM 文件，
+// 整幅图像从不驻留在内存中。常驻的 tile 缓冲最多 max_buffers 个，写完后回收重用，
+// 所以内存占用取决于同时在渲染和排队写盘的 tile 数，与图像大小无关。
+// 磁盘落后 max_buffers 个 tile 以上时，acquire 不等待，而是临时分配一块溢出缓冲，写完即释放；
+// overflow_count 记录发生的次数，经常溢出说明 max_buffers 太小或磁盘太慢。
+class tile_writer {
+public:
+  // PNG 和 HDR 需要整幅图像一起编码，无法流式写入
+  static bool supports(const std::string& path) {
+    auto format = format_from_path(path);
+    return format == image_format::ppm || format == image_format::pfm;
+  }
+
+  tile_writer(const std::string& path, int width, int height, size_t max_buffers)
+    : image_width(width), image_height(height), format(format_from_path(path)),
+      buffer_limit(max_buffers > 0 ? max_buffers : 1) {
+    out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (format == image_format::pfm) {
+      out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+      pixel_bytes = 3 * sizeof(float);
+    }
+    else {
+      out << "P6\n" << width << ' ' << height << "\n255\n";
+      pixel_bytes = 3;
+    }
+    header_bytes = out.tellp();
+
+    // 预先把文件扩展到最终大小，之后每一行都是覆盖写
+    auto total = header_bytes + static_cast<std::streamoff>(width) * height * pixel_bytes;
+    if (total > header_bytes) {
+      out.seekp(total - 1);
+      out.put('\0');
+    }
+
+    io_thread = std::thread([this] { run(); });
+  }
+
+  ~tile_writer() { finish(); }
+
+  // 取一块空闲缓冲并设为覆盖 t，从不阻塞渲染线程
+  framebuffer* acquire(const tile& t) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (free_buffers.empty()) {
+      if (buffers.size() >= buffer_limit)
+        ++overflows;
+      buffers.push_back(std::make_unique<framebuffer>());
+      free_buffers.push_back(buffers.back().get());
+    }
+
+    auto buffer = free_buffers.back();
+    free_buffers.pop_back();
+    lock.unlock();
+
+    buffer->reset(t.x1 - t.x0, t.y1 - t.y0, t.x0, t.y0);
+    return buffer;
+  }
+
+  // 把渲染完的缓冲交给 I/O 线程，不等待写盘
+  void submit(framebuffer* buffer) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.push_back(buffer);
+    }
+    work_ready.notify_one();
+  }
+
+  // 写完队列中所有的 tile 并关闭文件
+  bool finish() {
+    if (io_thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      work_ready.notify_one();
+      io_thread.join();
+      out.close();
+    }
+    return !failed;
+  }
+
+  size_t buffer_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return buffers.size();
+  }
+
+  // acquire 超出 max_buffers 而分配溢出缓冲的次数
+  size_t overflow_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return overflows;
+  }
+
+private:
+  int image_width;
+  int image_height;
+  image_format format;
+  size_t buffer_limit;
+  std::streamoff pixel_bytes = 3;
+  std::streamoff header_bytes = 0;
+  std::ofstream out;
+  bool failed = false;
+
+  mutable std::mutex mutex;
+  std::condition_variable work_ready;
+  std::vector<std::unique_ptr<framebuffer>> buffers;
+  std::vector<framebuffer*> free_buffers;
+  std::deque<framebuffer*> pending;
+  size_t overflows = 0;
+  bool stopping = false;
+  std::thread io_thread;
+
+  void run() {
+    std::vector<char> row;
+    while (true) {
+      framebuffer* buffer;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_ready.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty())
+          return;
+        buffer = pending.front();
+        pending.pop_front();
+      }
+
+      write_tile(*buffer, row);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (buffers.size() > buffer_limit) {
+        // 溢出期间多出的缓冲写完就释放，常驻数量回到 max_buffers
+        auto owned = std::find_if(buffers.begin(), buffers.end(),
+                                  [buffer](const std::unique_ptr<framebuffer>& b) { return b.get() == buffer; });
+        buffers.erase(owned);
+      }
+      else {
+        free_buffers.push_back(buffer);
+      }
+    }
+  }
+
+  // tile 的每一行在文件中是连续的一段，定位后一次写入
+  void write_tile(const framebuffer& buffer, std::vector<char>& row) {
+    size_t count = static_cast<size_t>(buffer.width()) * 3;
+    row.resize(static_cast<size_t>(buffer.width() * pixel_bytes));
+
+    for (int dy = 0; dy < buffer.height(); ++dy) {
+      const float* src = buffer.data() + dy * count;
+      int y = buffer.origin_y() + dy;
+
+      if (format == image_format::pfm) {
+        y = image_height - 1 - y; // PFM 的行从下往上排列
+        std::memcpy(row.data(), src, count * sizeof(float));
+      }
+      else {
+        encode_8bit(src, count, reinterpret_cast<uint8_t*>(row.data()));
+      }
+
+      auto pixel = static_cast<std::streamoff>(y) * image_width + buffer.origin_x();
+      out.seekp(header_bytes + pixel * pixel_bytes);
+      out.write(row.data(), row.size());
+    }
+
+    if (!out)
+      failed = true;
+  }
+};
+
+#endif
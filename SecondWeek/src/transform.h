@@ -0,0 +1,177 @@
+﻿#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "common.h"
+
+#include "aabb.h"
+
+// 4x4 仿射变换，同时保存逆矩阵，变换点、方向、法线时都不需要再求逆。
+// 矩阵按行存放，作用在列向量上，最后一行总是 (0, 0, 0, 1)
+class transform {
+public:
+  transform() {
+    set_identity(m);
+    set_identity(inv);
+  }
+
+  // 由任意仿射矩阵构造，逆矩阵由左上 3x3 的逆和平移部分求出
+  explicit transform(const double matrix[4][4]) {
+    for (int i = 0; i < 4; ++i)
+      for (int j = 0; j < 4; ++j)
+        m[i][j] = matrix[i][j];
+    m[3][0] = m[3][1] = m[3][2] = 0;
+    m[3][3] = 1;
+
+    auto c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    auto c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    auto c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    auto det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+    auto inv_det = 1 / det;
+
+    inv[0][0] = c00 * inv_det;
+    inv[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+    inv[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+    inv[1][0] = c01 * inv_det;
+    inv[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+    inv[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+    inv[2][0] = c02 * inv_det;
+    inv[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+    inv[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+    for (int i = 0; i < 3; ++i)
+      inv[i][3] = -(inv[i][0] * m[0][3] + inv[i][1] * m[1][3] + inv[i][2] * m[2][3]);
+    inv[3][0] = inv[3][1] = inv[3][2] = 0;
+    inv[3][3] = 1;
+  }
+
+  static transform translate(const vec3& offset) {
+    transform t;
+    for (int i = 0; i < 3; ++i) {
+      t.m[i][3] = offset[i];
+      t.inv[i][3] = -offset[i];
+    }
+    return t;
+  }
+
+  static transform scale(const vec3& s) {
+    transform t;
+    for (int i = 0; i < 3; ++i) {
+      t.m[i][i] = s[i];
+      t.inv[i][i] = 1 / s[i];
+    }
+    return t;
+  }
+
+  // 绕过原点的 axis 轴旋转 angle 度(右手定则)，axis 为 (0, 1, 0) 时和 rotate_y 相同
+  static transform rotate(const vec3& axis, double angle) {
+    auto a = unit_vector(axis);
+    auto radians = degrees_to_radians(angle);
+    auto s = sin(radians);
+    auto c = cos(radians);
+
+    transform t;
+    t.m[0][0] = a.x() * a.x() + (1 - a.x() * a.x()) * c;
+    t.m[0][1] = a.x() * a.y() * (1 - c) - a.z() * s;
+    t.m[0][2] = a.x() * a.z() * (1 - c) + a.y() * s;
+    t.m[1][0] = a.x() * a.y() * (1 - c) + a.z() * s;
+    t.m[1][1] = a.y() * a.y() + (1 - a.y() * a.y()) * c;
+    t.m[1][2] = a.y() * a.z() * (1 - c) - a.x() * s;
+    t.m[2][0] = a.x() * a.z() * (1 - c) - a.y() * s;
+    t.m[2][1] = a.y() * a.z() * (1 - c) + a.x() * s;
+    t.m[2][2] = a.z() * a.z() + (1 - a.z() * a.z()) * c;
+
+    // 旋转矩阵的逆就是转置
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 3; ++j)
+        t.inv[i][j] = t.m[j][i];
+    return t;
+  }
+
+  // a * b 先做 b 再做 a
+  friend transform operator*(const transform& a, const transform& b) {
+    transform t;
+    multiply(a.m, b.m, t.m);
+    multiply(b.inv, a.inv, t.inv);
+    return t;
+  }
+
+  transform inverse() const {
+    transform t;
+    copy(inv, t.m);
+    copy(m, t.inv);
+    return t;
+  }
+
+  point3 point(const point3& p) const { return apply_point(m, p); }
+  vec3 vector(const vec3& v) const { return apply_vector(m, v); }
+  point3 inverse_point(const point3& p) const { return apply_point(inv, p); }
+  vec3 inverse_vector(const vec3& v) const { return apply_vector(inv, v); }
+
+  // 法线按逆矩阵的转置变换，结果没有归一化
+  vec3 normal(const vec3& n) const {
+    return vec3(inv[0][0] * n.x() + inv[1][0] * n.y() + inv[2][0] * n.z(),
+                inv[0][1] * n.x() + inv[1][1] * n.y() + inv[2][1] * n.z(),
+                inv[0][2] * n.x() + inv[1][2] * n.y() + inv[2][2] * n.z());
+  }
+
+  // 逆矩阵左上 3x3 行列式的绝对值，方向经过逆变换后立体角按它缩放
+  double inverse_determinant() const {
+    return fabs(inv[0][0] * (inv[1][1] * inv[2][2] - inv[1][2] * inv[2][1])
+              - inv[0][1] * (inv[1][0] * inv[2][2] - inv[1][2] * inv[2][0])
+              + inv[0][2] * (inv[1][0] * inv[2][1] - inv[1][1] * inv[2][0]));
+  }
+
+  // 变换后包围盒的包围盒：每一行分别取各分量的较小和较大贡献相加(Arvo 的方法)
+  aabb box(const aabb& b) const {
+    if (b.x.min > b.x.max || b.y.min > b.y.max || b.z.min > b.z.max)
+      return aabb();
+
+    interval out[3];
+    for (int i = 0; i < 3; ++i) {
+      double lo = m[i][3], hi = m[i][3];
+      for (int j = 0; j < 3; ++j) {
+        auto e0 = m[i][j] * b.axis(j).min;
+        auto e1 = m[i][j] * b.axis(j).max;
+        lo += fmin(e0, e1);
+        hi += fmax(e0, e1);
+      }
+      out[i] = interval(lo, hi);
+    }
+    return aabb(out[0], out[1], out[2]);
+  }
+
+private:
+  double m[4][4];
+  double inv[4][4];
+
+  static void set_identity(double a[4][4]) {
+    for (int i = 0; i < 4; ++i)
+      for (int j = 0; j < 4; ++j)
+        a[i][j] = i == j ? 1 : 0;
+  }
+
+  static void copy(const double a[4][4], double out[4][4]) {
+    for (int i = 0; i < 4; ++i)
+      for (int j = 0; j < 4; ++j)
+        out[i][j] = a[i][j];
+  }
+
+  static void multiply(const double a[4][4], const double b[4][4], double out[4][4]) {
+    for (int i = 0; i < 4; ++i)
+      for (int j = 0; j < 4; ++j)
+        out[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j] + a[i][3] * b[3][j];
+  }
+
+  static point3 apply_point(const double a[4][4], const point3& p) {
+    return point3(a[0][0] * p.x() + a[0][1] * p.y() + a[0][2] * p.z() + a[0][3],
+                  a[1][0] * p.x() + a[1][1] * p.y() + a[1][2] * p.z() + a[1][3],
+                  a[2][0] * p.x() + a[2][1] * p.y() + a[2][2] * p.z() + a[2][3]);
+  }
+
+  static vec3 apply_vector(const double a[4][4], const vec3& v) {
+    return vec3(a[0][0] * v.x() + a[0][1] * v.y() + a[0][2] * v.z(),
+                a[1][0] * v.x() + a[1][1] * v.y() + a[1][2] * v.z(),
+                a[2][0] * v.x() + a[2][1] * v.y() + a[2][2] * v.z());
+  }
+};
+
+#endif
@@ -114,16 +114,27 @@ inline vec3 unit_vector(vec3 v) {
   return v / v.length();
 }
 
+// 随机采样都用解析式直接变换，不再用拒绝采样，每个样本消耗的随机数个数固定
+inline vec3 random_unit_vector() {
+  // Uniform direction on the unit sphere: z uniform in [-1,1], phi uniform in [0,2pi).
+  auto z = 1 - 2 * random_double();
+  auto r = sqrt(fmax(0.0, 1 - z * z));
+  auto phi = 2 * pi * random_double();
+  return vec3(r * cos(phi), r * sin(phi), z);
+}
+
 inline vec3 random_in_unit_sphere() {
-  while (true) {
-    auto p = vec3::random(-1, 1);
-    if (p.length_squared() >= 1) continue;
-    return p;
-  }
+  // 半径取均匀数的立方根，使点在球体内均匀分布
+  return cbrt(random_double()) * random_unit_vector();
 }
 
-inline vec3 random_unit_vector() { 
-  return unit_vector(random_in_unit_sphere());
+inline vec3 random_cosine_direction() {
+  // 以 +z 为轴的余弦分布，密度 cos(theta) / pi
+  auto r1 = random_double();
+  auto r2 = random_double();
+  auto phi = 2 * pi * r1;
+  auto r = sqrt(r2);
+  return vec3(r * cos(phi), r * sin(phi), sqrt(1 - r2));
 }
 
 inline vec3 random_in_hemisphere(const vec3& normal) {
@@ -134,12 +145,30 @@ inline vec3 random_in_hemisphere(const vec3& normal) {
     return -in_unit_sphere;
 }
 
-vec3 random_in_unit_disk() {
-  while (true) {
-    auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-    if (p.length_squared() >= 1) continue;
-    return p;
+inline vec3 random_in_unit_disk() {
+  // 半径取均匀数的平方根，使点在圆盘内均匀分布
+  auto r = sqrt(random_double());
+  auto theta = 2 * pi * random_double();
+  return vec3(r * cos(theta), r * sin(theta), 0);
+}
+
+// 把单位正方形上的点映射到单位圆盘(Shirley 同心映射)：面积均匀，并且保持样本在正方形上的分层
+inline vec3 square_to_disk(double u1, double u2) {
+  auto a = 2 * u1 - 1;
+  auto b = 2 * u2 - 1;
+  if (a == 0 && b == 0)
+    return vec3(0, 0, 0);
+
+  double r, theta;
+  if (fabs(a) > fabs(b)) {
+    r = a;
+    theta = (pi / 4) * (b / a);
+  }
+  else {
+    r = b;
+    theta = pi / 2 - (pi / 4) * (a / b);
   }
+  return vec3(r * cos(theta), r * sin(theta), 0);
 }
 
 inline vec3 reflect(const vec3& v, const vec3& n) {
@@ -0,0 +1,297 @@
+﻿#ifndef VOLUME_H
+#define VOLUME_H
+
+#include "common.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+// 密度网格：nx x ny x nz 个体素均匀覆盖 bounds，在体素中心取样，查询时三线性插值。
+// 按 8x8x8 的砖块存放：每个砖块一个 float 比例，体素量化为 8 位，全为 0 的砖块不分配。
+// 每个砖块同时记录它覆盖的区域内插值能取到的最大密度，作为 delta tracking 的 majorant 网格
+class density_grid {
+public:
+  static constexpr int brick_size = 8;
+
+  // density 在每个体素中心求一次(比如 perlin 的 turb)，之后查询只读网格
+  density_grid(const aabb& bounds, int nx, int ny, int nz, const std::function<double(const point3&)>& density)
+    : box(bounds) {
+    int res[3] = { nx, ny, nz };
+    for (int a = 0; a < 3; a++) {
+      n[a] = std::max(1, res[a]);
+      nb[a] = (n[a] + brick_size - 1) / brick_size;
+      voxel[a] = box.axis(a).size() / n[a];
+      inv_voxel[a] = 1 / voxel[a];
+    }
+
+    // 一次只求一个砖块，构建时不需要整个网格的 float 副本
+    brick_index.assign(static_cast<size_t>(nb[0]) * nb[1] * nb[2], -1);
+    float values[brick_size * brick_size * brick_size];
+    for (int bz = 0; bz < nb[2]; ++bz)
+      for (int by = 0; by < nb[1]; ++by)
+        for (int bx = 0; bx < nb[0]; ++bx) {
+          float max_value = 0;
+          for (int z = 0; z < brick_size; ++z)
+            for (int y = 0; y < brick_size; ++y)
+              for (int x = 0; x < brick_size; ++x) {
+                int i = bx * brick_size + x, j = by * brick_size + y, k = bz * brick_size + z;
+                float v = 0;
+                if (i < n[0] && j < n[1] && k < n[2]) {
+                  point3 p(box.x.min + (i + 0.5) * voxel[0], box.y.min + (j + 0.5) * voxel[1], box.z.min + (k + 0.5) * voxel[2]);
+                  v = static_cast<float>(std::max(0.0, density(p)));
+                }
+                values[(z * brick_size + y) * brick_size + x] = v;
+                max_value = std::max(max_value, v);
+              }
+          if (max_value <= 0)
+            continue;
+
+          brick_index[brick_id(bx, by, bz)] = static_cast<int32_t>(brick_scale.size());
+          brick_scale.push_back(max_value / 255);
+          for (auto v : values)
+            voxels.push_back(static_cast<uint8_t>(std::lround(v / max_value * 255)));
+        }
+
+    // 砖块区域内的点插值时最远用到相邻砖块的一层体素
+    majorant.assign(brick_index.size(), 0);
+    for (int bz = 0; bz < nb[2]; ++bz)
+      for (int by = 0; by < nb[1]; ++by)
+        for (int bx = 0; bx < nb[0]; ++bx) {
+          float m = 0;
+          for (int k = bz * brick_size - 1; k <= (bz + 1) * brick_size; ++k)
+            for (int j = by * brick_size - 1; j <= (by + 1) * brick_size; ++j)
+              for (int i = bx * brick_size - 1; i <= (bx + 1) * brick_size; ++i)
+                m = std::max(m, voxel_value(i, j, k));
+          majorant[brick_id(bx, by, bz)] = m;
+        }
+  }
+
+  double lookup(const point3& p) const {
+    double g[3];
+    int i0[3];
+    for (int a = 0; a < 3; a++) {
+      g[a] = (p[a] - box.axis(a).min) * inv_voxel[a] - 0.5;
+      auto f = std::floor(g[a]);
+      i0[a] = static_cast<int>(f);
+      g[a] -= f;
+    }
+
+    double c[2][2][2];
+    for (int dz = 0; dz < 2; ++dz)
+      for (int dy = 0; dy < 2; ++dy)
+        for (int dx = 0; dx < 2; ++dx)
+          c[dx][dy][dz] = voxel_value(i0[0] + dx, i0[1] + dy, i0[2] + dz);
+
+    auto u = g[0], v = g[1], w = g[2];
+    auto x00 = c[0][0][0] + u * (c[1][0][0] - c[0][0][0]);
+    auto x10 = c[0][1][0] + u * (c[1][1][0] - c[0][1][0]);
+    auto x01 = c[0][0][1] + u * (c[1][0][1] - c[0][0][1]);
+    auto x11 = c[0][1][1] + u * (c[1][1][1] - c[0][1][1]);
+    auto y0 = x00 + v * (x10 - x00);
+    auto y1 = x01 + v * (x11 - x01);
+    return y0 + w * (y1 - y0);
+  }
+
+  const aabb& bounds() const { return box; }
+  int bricks(int axis) const { return nb[axis]; }
+  double brick_extent(int axis) const { return voxel[axis] * brick_size; }
+  double brick_majorant(int bx, int by, int bz) const { return majorant[brick_id(bx, by, bz)]; }
+
+  size_t allocated_bricks() const { return brick_scale.size(); }
+  size_t memory_bytes() const {
+    return voxels.size() + brick_scale.size() * sizeof(float)
+      + brick_index.size() * (sizeof(int32_t) + sizeof(float));
+  }
+
+  void print(const char* name) const {
+    std::clog << name << ": " << n[0] << "x" << n[1] << "x" << n[2] << " voxels, " << allocated_bricks() << "/"
+      << brick_index.size() << " bricks allocated, " << memory_bytes() / 1024.0 / 1024.0 << " MB ("
+      << static_cast<double>(n[0]) * n[1] * n[2] * sizeof(float) / 1024 / 1024 << " MB as dense floats)\n";
+  }
+
+private:
+  aabb box;
+  int n[3];
+  int nb[3];
+  double voxel[3];
+  double inv_voxel[3];
+  std::vector<int32_t> brick_index;  // 每个砖块在 brick_scale 中的序号，-1 为空砖块
+  std::vector<float> brick_scale;    // 量化值 1 对应的密度
+  std::vector<uint8_t> voxels;       // 分配的砖块依次存放，每块 brick_size^3 个
+  std::vector<float> majorant;
+
+  size_t brick_id(int bx, int by, int bz) const {
+    return (static_cast<size_t>(bz) * nb[1] + by) * nb[0] + bx;
+  }
+
+  // 网格外的体素取最近的边界体素
+  float voxel_value(int i, int j, int k) const {
+    i = std::clamp(i, 0, n[0] - 1);
+    j = std::clamp(j, 0, n[1] - 1);
+    k = std::clamp(k, 0, n[2] - 1);
+    auto index = brick_index[brick_id(i / brick_size, j / brick_size, k / brick_size)];
+    if (index < 0)
+      return 0;
+    auto local = ((k % brick_size) * brick_size + (j % brick_size)) * brick_size + (i % brick_size);
+    return voxels[static_cast<size_t>(index) * brick_size * brick_size * brick_size + local] * brick_scale[index];
+  }
+};
+
+// 非均匀介质：密度 = density_scale x 网格密度。光线用 3D-DDA 逐个穿过 majorant 网格(砖块)，
+// 在每个砖块里按它的 majorant 做 delta tracking：按指数分布前进，以 密度/majorant 的概率接受为散射点，
+// 否则是虚碰撞、继续前进。majorant 为 0 的砖块一步跨过，不查密度。
+// 虚碰撞的次数不定，tracking 的随机数全部取自弹射的 PCG32 流(random_stream_double)，不占采样器维度。
+// boundary 为空时介质就是网格的包围盒，否则再和 boundary 内部(hit_intervals)取交
+class heterogeneous_medium : public hittable {
+public:
+  heterogeneous_medium(shared_ptr<const density_grid> grid, double density_scale, shared_ptr<texture> a,
+                       shared_ptr<hittable> boundary = nullptr)
+    : grid(grid), density_scale(density_scale), boundary(boundary), phase_function(make_shared<isotropic>(a)) {}
+
+  heterogeneous_medium(shared_ptr<const density_grid> grid, double density_scale, color c,
+                       shared_ptr<hittable> boundary = nullptr)
+    : grid(grid), density_scale(density_scale), boundary(boundary), phase_function(make_shared<isotropic>(c)) {}
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    // 先裁剪到网格的包围盒
+    const auto& box = grid->bounds();
+    double inv_dir[3];
+    interval inside = ray_t;
+    if (inside.min < 0) inside.min = 0;
+    for (int a = 0; a < 3; a++) {
+      inv_dir[a] = 1 / r.direction()[a];
+      auto t0 = (box.axis(a).min - r.origin()[a]) * inv_dir[a];
+      auto t1 = (box.axis(a).max - r.origin()[a]) * inv_dir[a];
+      if (inv_dir[a] < 0)
+        std::swap(t0, t1);
+      if (t0 > inside.min) inside.min = t0;
+      if (t1 < inside.max) inside.max = t1;
+      if (inside.max <= inside.min)
+        return false;
+    }
+
+    span_list spans;
+    if (boundary)
+      boundary->hit_intervals(r, spans);
+    else
+      spans.add(interval::universe);
+
+    uint64_t lookups = 0, cells = 0;
+    bool found = false;
+    while (true) {
+      for (int s = 0; s < spans.count && !found; ++s) {
+        interval span(fmax(spans.spans[s].min, inside.min), fmin(spans.spans[s].max, inside.max));
+        if (span.min < span.max)
+          found = track(r, inv_dir, span, rec, lookups, cells);
+      }
+
+      // 和 constant_medium 相同，区间超出容量时从最后一段之后继续查询
+      auto resume = spans.overflow ? spans.spans[spans.count - 1].max + 0.0001 : infinity;
+      if (found || resume >= inside.max)
+        break;
+      spans.clear();
+      boundary->hit_intervals_from(r, resume, spans);
+    }
+
+    rays.fetch_add(1, std::memory_order_relaxed);
+    density_lookups.fetch_add(lookups, std::memory_order_relaxed);
+    majorant_cells.fetch_add(cells, std::memory_order_relaxed);
+    return found;
+  }
+
+  aabb bounding_box() const override { return boundary ? boundary->bounding_box() : grid->bounds(); }
+
+  bool stochastic_hit() const override { return true; }
+
+  // 渲染后输出开销：进入网格包围盒的光线数，以及平均每条光线查询密度、穿过 majorant 砖块的次数
+  void report(const char* name = "heterogeneous_medium") const {
+    auto n = rays.load();
+    std::clog << name << ": " << n << " rays, "
+      << (n ? static_cast<double>(density_lookups.load()) / n : 0) << " density lookups per ray, "
+      << (n ? static_cast<double>(majorant_cells.load()) / n : 0) << " majorant cells per ray\n";
+  }
+
+private:
+  shared_ptr<const density_grid> grid;
+  double density_scale;
+  shared_ptr<hittable> boundary;
+  shared_ptr<material> phase_function;
+
+  // 开销统计，多个渲染线程一起累加，每次 hit 只加一次
+  mutable std::atomic<uint64_t> rays{ 0 };
+  mutable std::atomic<uint64_t> density_lookups{ 0 };
+  mutable std::atomic<uint64_t> majorant_cells{ 0 };
+
+  // 在 [span.min, span.max] 内做 delta tracking，找到真碰撞时写入 rec
+  bool track(const ray& r, const double inv_dir[3], const interval& span, hit_record& rec,
+             uint64_t& lookups, uint64_t& cells) const {
+    const auto& box = grid->bounds();
+    auto ray_length = r.direction().length();
+
+    int cell[3], step[3], out[3];
+    double t_next[3], t_delta[3];
+    for (int a = 0; a < 3; a++) {
+      auto size = grid->brick_extent(a);
+      auto p = r.origin()[a] + span.min * r.direction()[a];
+      cell[a] = std::clamp(static_cast<int>((p - box.axis(a).min) / size), 0, grid->bricks(a) - 1);
+      if (r.direction()[a] == 0) {
+        step[a] = 0;
+        out[a] = -1;
+        t_next[a] = t_delta[a] = infinity;
+        continue;
+      }
+      t_delta[a] = size * std::fabs(inv_dir[a]);
+      step[a] = r.direction()[a] > 0 ? 1 : -1;
+      out[a] = r.direction()[a] > 0 ? grid->bricks(a) : -1;
+      auto boundary_cell = r.direction()[a] > 0 ? cell[a] + 1 : cell[a];
+      t_next[a] = (box.axis(a).min + boundary_cell * size - r.origin()[a]) * inv_dir[a];
+    }
+
+    auto t = span.min;
+    for (;;) {
+      int a = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+      auto t_cell = fmin(t_next[a], span.max);
+      ++cells;
+
+      auto m = density_scale * grid->brick_majorant(cell[0], cell[1], cell[2]);
+      if (m > 0) {
+        auto inv_m = 1 / (m * ray_length);
+        for (;;) {
+          t -= std::log(1 - random_stream_double()) * inv_m;
+          if (t >= t_cell)
+            break;
+          ++lookups;
+          auto p = r.at(t);
+          if (random_stream_double() * m < density_scale * grid->lookup(p)) {
+            rec.t = t;
+            rec.p = p;
+            rec.normal = vec3(1, 0, 0);  // arbitrary
+            rec.front_face = true;       // also arbitrary
+            rec.mat_ptr = phase_function.get();
+            return true;
+          }
+        }
+      }
+
+      // 指数分布无记忆，越过砖块边界的一步在边界处重新开始
+      if (t_cell >= span.max)
+        return false;
+      t = t_cell;
+      cell[a] += step[a];
+      if (cell[a] == out[a])
+        return false;
+      t_next[a] += t_delta[a];
+    }
+  }
+};
+
+#endif